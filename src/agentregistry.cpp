@@ -0,0 +1,99 @@
+#include <limits>
+
+#include "agentregistry.h"
+
+using namespace std;
+
+const int AgentRegistry::aucun = numeric_limits<int>::max();
+
+AgentRegistry::AgentRegistry()
+    : positions { }, cases { }, types { }, place { }, vivants { },
+        occupant { } {
+}
+
+void AgentRegistry::reset(size_t cells) {
+  positions.clear();
+  cases.clear();
+  types.clear();
+  place.clear();
+  vivants.clear();
+  occupant.assign(cells, aucun);
+}
+
+void AgentRegistry::add(int rank, const Position& pos, index_type cell,
+    char kind) {
+  auto r = static_cast<size_t>(rank);
+  if (r >= place.size()) {
+    positions.resize(r + 1);
+    cases.resize(r + 1);
+    types.resize(r + 1);
+    place.resize(r + 1, -1);
+  }
+  if (place[r] < 0) {
+    place[r] = static_cast<int>(vivants.size());
+    vivants.push_back(rank);
+  } else {
+    occupant[cases[r]] = aucun;
+  }
+  positions[r] = pos;
+  cases[r] = cell;
+  types[r] = kind;
+  occupant[cell] = rank;
+}
+
+void AgentRegistry::setKind(int rank, char kind) {
+  types[rank] = kind;
+}
+
+void AgentRegistry::move(int rank, const Position& pos, index_type cell) {
+  if (occupant[cases[rank]] == rank) {
+    occupant[cases[rank]] = aucun;
+  }
+  positions[rank] = pos;
+  cases[rank] = cell;
+  occupant[cell] = rank;
+}
+
+void AgentRegistry::remove(int rank) {
+  if (!alive(rank)) {
+    return;
+  }
+  if (occupant[cases[rank]] == rank) {
+    occupant[cases[rank]] = aucun;
+  }
+  auto p = place[rank];
+  auto dernier = vivants.back();
+  vivants[p] = dernier;
+  place[dernier] = p;
+  vivants.pop_back();
+  place[rank] = -1;
+}
+
+bool AgentRegistry::alive(int rank) const noexcept {
+  return rank >= 0 && static_cast<size_t>(rank) < place.size()
+      && place[rank] >= 0;
+}
+
+int AgentRegistry::rankAt(index_type cell) const noexcept {
+  return cell < occupant.size() ? occupant[cell] : aucun;
+}
+
+const Position& AgentRegistry::position(int rank) const {
+  return positions[rank];
+}
+
+AgentRegistry::index_type AgentRegistry::cell(int rank) const {
+  return cases[rank];
+}
+
+char AgentRegistry::kind(int rank) const {
+  return types[rank];
+}
+
+size_t AgentRegistry::size() const noexcept {
+  return vivants.size();
+}
+
+const vector<int>& AgentRegistry::ranks() const noexcept {
+  return vivants;
+}
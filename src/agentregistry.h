@@ -0,0 +1,53 @@
+#ifndef AGENTREGISTRY_H_
+#define AGENTREGISTRY_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "position.h"
+
+/*
+ Registre des agents (chats et rats) d'une carte, par rang.
+
+ Les positions, cases, types et places dans la liste des vivants sont des
+ tableaux paralleles indexes par le rang, et chaque case de la grille
+ connait le rang de son occupant : retrouver l'agent d'une case, la case
+ d'un agent ou deplacer, retirer un agent se fait en temps constant.
+ */
+class AgentRegistry {
+public:
+  using index_type = std::size_t;
+  static const int aucun; // rang d'une case inoccupee
+
+  AgentRegistry();
+
+  /*
+   Vide le registre pour une grille de <cells> cases.
+   */
+  void reset(std::size_t cells);
+  void add(int rank, const Position&, index_type cell, char kind);
+  void setKind(int rank, char kind);
+  void move(int rank, const Position&, index_type cell);
+  // retire un agent vivant : le dernier de la liste des vivants prend sa place
+  void remove(int rank);
+
+  bool alive(int rank) const noexcept;
+  // rang de l'agent en <cell>, aucun si la case est libre
+  int rankAt(index_type cell) const noexcept;
+  const Position& position(int rank) const;
+  index_type cell(int rank) const;
+  char kind(int rank) const;
+  // nombre d'agents vivants
+  std::size_t size() const noexcept;
+  // rangs des agents vivants, sans ordre particulier
+  const std::vector<int>& ranks() const noexcept;
+private:
+  std::vector<Position> positions;
+  std::vector<index_type> cases;
+  std::vector<char> types;
+  std::vector<int> place; // dans vivants, -1 si l'agent n'y est pas
+  std::vector<int> vivants;
+  std::vector<int> occupant; // par case de la grille
+};
+
+#endif /* AGENTREGISTRY_H_ */
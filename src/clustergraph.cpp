@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <limits>
+
+#include "clustergraph.h"
+#include "map.h"
+
+using namespace std;
+
+namespace {
+
+const ClusterGraph::cost_type infini = numeric_limits<
+    ClusterGraph::cost_type>::max();
+
+/*
+ Espace de travail d'une recherche, propre au fil d'execution : les cases
+ atteintes sont marquees d'une generation, comme dans PathFinder.
+ */
+struct Recherche {
+  using index_type = ClusterGraph::index_type;
+  using cost_type = ClusterGraph::cost_type;
+  struct Noeud {
+    cost_type f, g;
+    index_type index;
+    bool operator<(const Noeud& n) const noexcept {
+      return f > n.f || (f == n.f && g < n.g); // tas min sur f
+    }
+  };
+
+  uint32_t generation { };
+  vector<uint32_t> vuSource, vuDest, vu, ferme;
+  vector<cost_type> dSource, dDest, g;
+  vector<index_type> parentSource, parent, file;
+  vector<Noeud> ouverts;
+  size_t expansions { };
+
+  void prepare(size_t cells) {
+    if (vu.size() < cells) {
+      for (auto v : { &vuSource, &vuDest, &vu, &ferme }) {
+        v->assign(cells, 0);
+      }
+      dSource.resize(cells);
+      dDest.resize(cells);
+      g.resize(cells);
+      parentSource.resize(cells);
+      parent.resize(cells);
+      generation = 0;
+    }
+    if (++generation == 0) {
+      for (auto v : { &vuSource, &vuDest, &vu, &ferme }) {
+        fill(begin(*v), end(*v), 0);
+      }
+      generation = 1;
+    }
+    ouverts.clear();
+    expansions = 0;
+  }
+};
+
+Recherche& recherche() {
+  thread_local Recherche r;
+  return r;
+}
+
+bool dans(const Position& p, int x0, int y0, int x1, int y1) {
+  return p.getX() >= x0 && p.getX() < x1 && p.getY() >= y0 && p.getY() < y1;
+}
+
+}
+
+ClusterGraph::ClusterGraph()
+    : type { }, cote { }, nx { }, ny { }, clusters { }, slot { }, sale { },
+        sales { }, distance { }, file { } {
+}
+
+void ClusterGraph::Build(const Map& map, char t, size_t c) {
+  type = t;
+  cote = c;
+  reset(map);
+  Repair(map);
+}
+
+void ClusterGraph::reset(const Map& map) {
+  sales.clear();
+  if (!cote) {
+    clusters.clear();
+    slot.clear();
+    sale.clear();
+    return;
+  }
+  auto x = map.getSizeX(), y = map.getSizeY();
+  nx = (x + cote - 1) / cote;
+  ny = (y + cote - 1) / cote;
+  clusters.resize(nx * ny);
+  for (size_t k = 0; k != clusters.size(); ++k) {
+    auto& c = clusters[k];
+    c.x0 = static_cast<int>(k % nx * cote);
+    c.y0 = static_cast<int>(k / nx * cote);
+    c.x1 = static_cast<int>(min(c.x0 + cote, x));
+    c.y1 = static_cast<int>(min(c.y0 + cote, y));
+    c.entrees.clear();
+    c.distances.clear();
+    sales.push_back(k);
+  }
+  slot.assign(map.getCellCount(), -1);
+  sale.assign(clusters.size(), 1);
+  distance.assign(map.getCellCount(), infini);
+}
+
+size_t ClusterGraph::clusterOf(const Position& pos) const noexcept {
+  return pos.getY() / cote * nx + pos.getX() / cote;
+}
+
+// un agent qui bouge ne change pas le terrain, ni donc aucun cluster
+void ClusterGraph::invalidate(const Position& pos, char avant, char apres) {
+  if (!cote
+      || Map::isTraversable(type, avant) == Map::isTraversable(type, apres)) {
+    return;
+  }
+  auto k = clusterOf(pos);
+  if (!sale[k]) {
+    sale[k] = 1;
+    sales.push_back(k);
+  }
+}
+
+void ClusterGraph::Repair(const Map& map) {
+  if (sales.empty()) {
+    return;
+  }
+  // une case du bord change aussi les entrees du cluster voisin
+  for (size_t i = 0, n = sales.size(); i != n; ++i) {
+    auto k = sales[i];
+    auto x = k % nx, y = k / nx;
+    for (auto v : { x > 0 ? k - 1 : k, x + 1 < nx ? k + 1 : k, y > 0 ? k - nx : k,
+        y + 1 < ny ? k + nx : k }) {
+      if (!sale[v]) {
+        sale[v] = 1;
+        sales.push_back(v);
+      }
+    }
+  }
+  for (auto k : sales) {
+    rebuild(map, k);
+    sale[k] = 0;
+  }
+  sales.clear();
+}
+
+/*
+ Une entree par suite de cases franchissables des deux cotes de la frontiere,
+ parcourue depuis (x, y) sur n cases dans la direction (dx, dy) ; la case
+ voisine de l'autre cote est a <dehors>. Le cluster voisin trouve les memes
+ suites, donc l'entree en face.
+ */
+void ClusterGraph::addEntrances(const Map& map, Cluster& c, int x, int y,
+    int dx, int dy, int n, ptrdiff_t dehors) {
+  int debut = -1;
+  for (int t = 0; t <= n; ++t) {
+    bool ouvert = false;
+    if (t < n) {
+      auto i = map.getIndex(Position { x + dx * t, y + dy * t });
+      ouvert = Map::isTraversable(type, map.showIndex(i))
+          && Map::isTraversable(type, map.showIndex(i + dehors));
+    }
+    if (ouvert && debut < 0) {
+      debut = t;
+    } else if (!ouvert && debut >= 0) {
+      auto milieu = debut + (t - 1 - debut) / 2;
+      auto e = map.getIndex(Position { x + dx * milieu, y + dy * milieu });
+      if (slot[e] < 0) {
+        slot[e] = static_cast<int>(c.entrees.size());
+        c.entrees.push_back(e);
+      }
+      debut = -1;
+    }
+  }
+}
+
+// recalcule les entrees du cluster k et les distances entre elles
+void ClusterGraph::rebuild(const Map& map, size_t k) {
+  auto& c = clusters[k];
+  for (auto e : c.entrees) {
+    slot[e] = -1;
+  }
+  c.entrees.clear();
+  auto& offsets = map.getNeighbourOffsets(); // S, N, E, W
+  auto largeur = c.x1 - c.x0, hauteur = c.y1 - c.y0;
+  addEntrances(map, c, c.x0, c.y0, 1, 0, largeur, offsets[1]);
+  addEntrances(map, c, c.x0, c.y1 - 1, 1, 0, largeur, offsets[0]);
+  addEntrances(map, c, c.x0, c.y0, 0, 1, hauteur, offsets[3]);
+  addEntrances(map, c, c.x1 - 1, c.y0, 0, 1, hauteur, offsets[2]);
+
+  auto n = c.entrees.size();
+  c.distances.assign(n * n, infini);
+  for (size_t a = 0; a != n; ++a) {
+    file.clear();
+    file.push_back(c.entrees[a]);
+    distance[c.entrees[a]] = 0;
+    for (size_t tete = 0; tete != file.size(); ++tete) {
+      auto courant = file[tete];
+      for (auto it = begin(offsets); it != begin(offsets) + 4; ++it) {
+        auto voisin = courant + *it;
+        if (distance[voisin] == infini
+            && Map::isTraversable(type, map.showIndex(voisin))
+            && dans(map.getPosition(voisin), c.x0, c.y0, c.x1, c.y1)) {
+          distance[voisin] = distance[courant] + 1;
+          file.push_back(voisin);
+        }
+      }
+    }
+    for (size_t b = 0; b != n; ++b) {
+      c.distances[a * n + b] = distance[c.entrees[b]];
+    }
+    for (auto i : file) {
+      distance[i] = infini;
+    }
+  }
+}
+
+bool ClusterGraph::isEnabled() const noexcept {
+  return cote != 0;
+}
+
+bool ClusterGraph::isClean() const noexcept {
+  return sales.empty();
+}
+
+size_t ClusterGraph::getNodeCount() const noexcept {
+  size_t n { };
+  for (auto& c : clusters) {
+    n += c.entrees.size();
+  }
+  return n;
+}
+
+size_t ClusterGraph::getExpansions() noexcept {
+  return recherche().expansions;
+}
+
+/*
+ Un parcours en largeur dans le cluster de la source, un autre depuis la
+ destination dans le sien, relient ces deux cases aux entrees de leurs
+ clusters ; A* sur le graphe abstrait les joint. Dans un meme cluster, le
+ chemin interne est aussi candidat. Le premier pas est retrouve dans le
+ parcours depuis la source.
+
+ Les petits chemins passent eux aussi par ce modele plutot que par A* sur la
+ grille. Tant que le terrain ne change pas, le graphe abstrait reste le meme
+ et le pas retourne est le debut d'un chemin du modele : depuis ce pas, le
+ reste de ce chemin coute un de moins, et l'optimum du modele baisse d'au
+ moins un a chaque pas suivi. Un agent qui redemande son chemin a chaque
+ tour atteint donc son but, sauf si d'autres agents lui barrent la route
+ (Move refuse alors le pas).
+ */
+Position ClusterGraph::FirstStep(const Map& map, const Position& sourcePosition,
+    const Position& destPosition) const {
+  if (sourcePosition == destPosition || !map.contains(sourcePosition)
+      || !map.contains(destPosition)) {
+    return sourcePosition;
+  }
+  auto ks = clusterOf(sourcePosition), kd = clusterOf(destPosition);
+  auto source = map.getIndex(sourcePosition), dest = map.getIndex(
+      destPosition);
+  if (!Map::isTraversable(type, map.showIndex(dest))) {
+    return sourcePosition;
+  }
+  auto& r = recherche();
+  r.prepare(map.getCellCount());
+  auto& offsets = map.getNeighbourOffsets();
+
+  // parcours en largeur dans le cluster k depuis <depart>
+  auto parcourir = [&](size_t k, index_type depart, vector<uint32_t>& vu,
+      vector<cost_type>& d, vector<index_type>* parent) {
+    auto& c = clusters[k];
+    r.file.clear();
+    r.file.push_back(depart);
+    vu[depart] = r.generation;
+    d[depart] = 0;
+    for (size_t tete = 0; tete != r.file.size(); ++tete) {
+      auto courant = r.file[tete];
+      for (auto it = begin(offsets); it != begin(offsets) + 4; ++it) {
+        auto voisin = courant + *it;
+        if (vu[voisin] != r.generation
+            && Map::isTraversable(type, map.showIndex(voisin))
+            && dans(map.getPosition(voisin), c.x0, c.y0, c.x1, c.y1)) {
+          vu[voisin] = r.generation;
+          d[voisin] = d[courant] + 1;
+          if (parent) {
+            (*parent)[voisin] = courant;
+          }
+          r.file.push_back(voisin);
+        }
+      }
+    }
+  };
+  parcourir(ks, source, r.vuSource, r.dSource, &r.parentSource);
+  parcourir(kd, dest, r.vuDest, r.dDest, nullptr);
+
+  auto ouvrir = [&](index_type i, cost_type g, index_type parent) {
+    if (r.ferme[i] == r.generation
+        || (r.vu[i] == r.generation && r.g[i] <= g)) {
+      return;
+    }
+    r.vu[i] = r.generation;
+    r.g[i] = g;
+    r.parent[i] = parent;
+    auto h = Map::ManhattanDistance(map.getPosition(i), destPosition);
+    r.ouverts.push_back(Recherche::Noeud { g + h, g, i });
+    push_heap(begin(r.ouverts), end(r.ouverts));
+  };
+  // les entrees du cluster de la source sont les racines de la recherche
+  for (auto e : clusters[ks].entrees) {
+    if (r.vuSource[e] == r.generation) {
+      ouvrir(e, r.dSource[e], e);
+    }
+  }
+  auto meilleur = infini;
+  index_type fin { };
+  bool interne = false;
+  if (ks == kd && r.vuSource[dest] == r.generation) {
+    meilleur = r.dSource[dest];
+    interne = true;
+  }
+  while (!r.ouverts.empty()) {
+    pop_heap(begin(r.ouverts), end(r.ouverts));
+    auto n = r.ouverts.back();
+    r.ouverts.pop_back();
+    if (n.f >= meilleur) {
+      break;
+    }
+    if (r.ferme[n.index] == r.generation) {
+      continue;
+    }
+    r.ferme[n.index] = r.generation;
+    ++r.expansions;
+    if (r.vuDest[n.index] == r.generation
+        && n.g + r.dDest[n.index] < meilleur) {
+      meilleur = n.g + r.dDest[n.index];
+      fin = n.index;
+      interne = false;
+    }
+    auto k = clusterOf(map.getPosition(n.index));
+    auto& c = clusters[k];
+    auto s = static_cast<size_t>(slot[n.index]), taille = c.entrees.size();
+    for (size_t m = 0; m != taille; ++m) {
+      auto d = c.distances[s * taille + m];
+      if (m != s && d != infini) {
+        ouvrir(c.entrees[m], n.g + d, n.index);
+      }
+    }
+    for (auto it = begin(offsets); it != begin(offsets) + 4; ++it) {
+      auto voisin = n.index + *it;
+      if (slot[voisin] >= 0 && clusterOf(map.getPosition(voisin)) != k) {
+        ouvrir(voisin, n.g + 1, n.index);
+      }
+    }
+  }
+  if (meilleur == infini) {
+    return sourcePosition;
+  }
+  if (interne) {
+    auto cible = dest;
+    while (r.parentSource[cible] != source) {
+      cible = r.parentSource[cible];
+    }
+    return map.getPosition(cible);
+  }
+
+  // racine du chemin abstrait, et le noeud qui la suit
+  auto racine = fin, suivant = fin;
+  while (r.parent[racine] != racine) {
+    suivant = racine;
+    racine = r.parent[racine];
+  }
+  auto cible = racine;
+  if (racine == source) { // la source est elle-meme une entree
+    if (clusterOf(map.getPosition(suivant)) != ks) {
+      return map.getPosition(suivant);
+    }
+    cible = suivant;
+  }
+  while (r.parentSource[cible] != source) {
+    cible = r.parentSource[cible];
+  }
+  return map.getPosition(cible);
+}
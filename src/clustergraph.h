@@ -0,0 +1,97 @@
+#ifndef CLUSTERGRAPH_H_
+#define CLUSTERGRAPH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "position.h"
+
+class Map;
+
+/*
+ Couche hierarchique (HPA*) pour les recherches de chemin sur les grandes
+ cartes.
+
+ La grille est decoupee en clusters de cote x cote cases. Sur chaque frontiere
+ entre deux clusters, chaque suite de cases franchissables des deux cotes
+ donne une entree (sa case du milieu, de chaque cote) ; les distances entre
+ les entrees d'un meme cluster, sans en sortir, sont calculees d'avance. Une
+ recherche parcourt ce graphe abstrait et ne descend sur la grille que dans
+ les clusters de la source et de la destination.
+
+ Comme pour DistanceField, le graphe vaut pour un type d'element (RAT ou
+ CHAT) et pour le terrain seul : les cases des agents sont traversables, et
+ un pas retourne peut donc etre refuse par Move. Seul un changement de
+ terrain (fromage mange, par exemple) marque son cluster, que Repair
+ recalcule avec ses voisins avant la recherche suivante. Les chemins trouves
+ sont presque optimaux, pas toujours optimaux.
+ */
+class ClusterGraph {
+public:
+  using index_type = std::size_t;
+  using cost_type = std::int32_t;
+
+  ClusterGraph();
+
+  /*
+   Graphe de <map> pour un element de <type>, en clusters de <cote> cases.
+   Un cote nul desactive la couche.
+   */
+  void Build(const Map& map, char type, std::size_t cote);
+
+  /*
+   Redimensionne pour les dimensions de <map>, tous les clusters a
+   recalculer.
+   */
+  void reset(const Map& map);
+
+  // la case <pos> est passee de <avant> a <apres>
+  void invalidate(const Position& pos, char avant, char apres);
+
+  /*
+   Recalcule les clusters marques par invalidate et leurs voisins.
+   */
+  void Repair(const Map&);
+
+  bool isEnabled() const noexcept;
+  bool isClean() const noexcept;
+
+  /*
+   Premiere position d'un chemin de <source> vers <dest> pour l'element du
+   graphe. Retourne <source> si <dest> est inatteignable ou confondue avec
+   <source>.
+   \pre Repair a ete appele depuis le dernier changement.
+   */
+  Position FirstStep(const Map&, const Position& source,
+      const Position& dest) const;
+
+  // nombre d'entrees du graphe abstrait
+  std::size_t getNodeCount() const noexcept;
+  // noeuds abstraits developpes par la derniere recherche du fil appelant
+  static std::size_t getExpansions() noexcept;
+
+private:
+  struct Cluster {
+    int x0, y0, x1, y1; // cases du cluster, x1 et y1 exclues
+    std::vector<index_type> entrees;
+    std::vector<cost_type> distances; // entrees x entrees
+  };
+
+  std::size_t clusterOf(const Position&) const noexcept;
+  void rebuild(const Map&, std::size_t k);
+  void addEntrances(const Map&, Cluster&, int x, int y, int dx, int dy,
+      int n, std::ptrdiff_t dehors);
+
+  char type;
+  std::size_t cote, nx, ny;
+  std::vector<Cluster> clusters;
+  std::vector<int> slot; // par case : rang dans les entrees de son cluster
+  std::vector<char> sale; // par cluster
+  std::vector<std::size_t> sales;
+  // parcours internes aux clusters pendant Repair
+  std::vector<cost_type> distance;
+  std::vector<index_type> file;
+};
+
+#endif /* CLUSTERGRAPH_H_ */
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <limits>
+
+#include "distancefield.h"
+#include "map.h"
+
+using namespace std;
+
+const DistanceField::cost_type DistanceField::infini = numeric_limits<
+    DistanceField::cost_type>::max();
+
+DistanceField::DistanceField()
+    : type { }, valide { }, distance { }, file { } {
+}
+
+void DistanceField::Build(const Map& map, char t, const vector<Position>& goals) {
+  type = t;
+  distance.assign(map.getCellCount(), infini);
+  file.clear();
+  for (auto& g : goals) {
+    if (map.contains(g)) {
+      auto i = map.getIndex(g);
+      if (distance[i] == infini) {
+        distance[i] = 0;
+        file.push_back(i);
+      }
+    }
+  }
+  auto& offsets = map.getNeighbourOffsets();
+  for (size_t tete = 0; tete != file.size(); ++tete) {
+    auto courant = file[tete];
+    auto d = distance[courant] + 1;
+    for (auto it = begin(offsets); it != begin(offsets) + 4; ++it) {
+      auto voisin = courant + *it;
+      if (distance[voisin] == infini
+          && Map::isTraversable(type, map.showIndex(voisin))) {
+        distance[voisin] = d;
+        file.push_back(voisin);
+      }
+    }
+  }
+  valide = true;
+}
+
+Position DistanceField::NextStep(const Map& map, const Position& pos) const {
+  if (!map.contains(pos)) {
+    return pos;
+  }
+  auto courant = map.getIndex(pos);
+  auto meilleur = courant;
+  auto d = distance[courant];
+  if (d == 0) {
+    return pos;
+  }
+  auto& offsets = map.getNeighbourOffsets();
+  for (auto it = begin(offsets); it != begin(offsets) + 4; ++it) {
+    auto voisin = courant + *it;
+    if (distance[voisin] < d && Map::isWalkable(type, map.showIndex(voisin))) {
+      d = distance[voisin];
+      meilleur = voisin;
+    }
+  }
+  return map.getPosition(meilleur);
+}
+
+DistanceField::cost_type DistanceField::getDistance(index_type i) const
+    noexcept {
+  return distance[i];
+}
+
+bool DistanceField::isValid() const noexcept {
+  return valide;
+}
+
+void DistanceField::invalidate() noexcept {
+  valide = false;
+}
@@ -0,0 +1,52 @@
+#ifndef DISTANCEFIELD_H_
+#define DISTANCEFIELD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "position.h"
+
+class Map;
+
+/*
+ Champ de distances vers un ensemble de cibles, calcule par un seul parcours
+ en largeur depuis toutes les cibles a la fois.
+
+ Les agents (rats et chats) sont consideres traversables lors du calcul : ils
+ bougent a chaque tour et ne sont pris en compte qu'au moment de choisir le
+ prochain pas. Le champ reste donc valide tant que les cibles et le terrain
+ ne changent pas, et tous les agents d'un meme type peuvent le partager.
+ */
+class DistanceField {
+public:
+  using index_type = std::size_t;
+  using cost_type = std::int32_t;
+  static const cost_type infini;
+
+  DistanceField();
+
+  /*
+   Recalcule le champ vers <goals> pour un element de <type> (RAT ou CHAT).
+   */
+  void Build(const Map&, char type, const std::vector<Position>& goals);
+
+  /*
+   Case voisine de <pos> la plus proche des cibles parmi celles ou l'element
+   peut entrer maintenant. Retourne <pos> si l'element est deja sur une
+   cible, si aucune cible n'est atteignable ou si tous les voisins utiles
+   sont occupes.
+   */
+  Position NextStep(const Map&, const Position& pos) const;
+
+  cost_type getDistance(index_type) const noexcept;
+  bool isValid() const noexcept;
+  void invalidate() noexcept;
+private:
+  char type;
+  bool valide;
+  std::vector<cost_type> distance;
+  std::vector<index_type> file;
+};
+
+#endif /* DISTANCEFIELD_H_ */
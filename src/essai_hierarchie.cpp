@@ -0,0 +1,153 @@
+/*
+ * essai_hierarchie.cpp
+ *
+ * Verifie qu'un rat seul qui redemande HierarchicalShortestPath a chaque pas
+ * et le suit par Move atteint son but, des qu'il est atteignable (A* sur la
+ * grille faisant foi) : sur une petite carte ouverte ou il tournait en rond,
+ * puis sur des cartes generees de chaque topologie, en clusters de 4 et de 8
+ * cases, vers chaque fromage depuis une case libre tiree au hasard.
+ *
+ * usage : essai_hierarchie [cartes=n] [graine=n]
+ *
+ * Ecrit chaque echec (carte, cote, source, but, dernier pas) ; retourne 1
+ * s'il y en a eu.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "map.h"
+#include "mapgenerator.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ Suit le chemin de <source> vers <but> sur <texte>, en clusters de <cote>
+ cases. Retourne faux si le rat n'arrive pas alors que le but est
+ atteignable.
+ */
+bool suivre(const string& nom, size_t x, size_t y, const string& texte,
+    size_t cote, const Position& source, const Position& but) {
+  Map map { x, y, texte.data() };
+  map.EnableHierarchy(cote);
+  auto atteignable = map.AStarShortestPath(source, but) != source;
+  auto pos = source;
+  // un chemin du modele raccourcit a chaque pas : au plus une fois par case
+  for (size_t pas = 0; pas != map.getCellCount() && pos != but; ++pas) {
+    auto suivant = map.HierarchicalShortestPath(pos, but);
+    if (suivant == pos || Map::ManhattanDistance(pos, suivant) != 1
+        || map.Move(pos, suivant) != suivant) {
+      break;
+    }
+    pos = suivant;
+  }
+  if (pos == but || !atteignable) {
+    return true;
+  }
+  cerr << nom << " cote " << cote << " : de " << source << " vers " << but
+      << ", arrete en " << pos << endl;
+  return false;
+}
+
+// le rat de <texte> en <source>, les autres rats retires
+string placer(string texte, size_t x, const Position& source) {
+  for (auto& c : texte) {
+    if (c == RAT) {
+      c = VIDE;
+    }
+  }
+  texte[source.getY() * x + source.getX()] = RAT;
+  return texte;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  size_t cartes = 20;
+  uint32_t graine = 1;
+  for (int i = 1; i < argc; ++i) {
+    string arg { argv[i] };
+    if (arg.compare(0, 7, "cartes=") == 0) {
+      cartes = strtoul(arg.c_str() + 7, nullptr, 10);
+    } else if (arg.compare(0, 7, "graine=") == 0) {
+      graine = static_cast<uint32_t>(strtoul(arg.c_str() + 7, nullptr, 10));
+    } else {
+      cerr << "usage : essai_hierarchie [cartes=n] [graine=n]" << endl;
+      return 1;
+    }
+  }
+  size_t suivis { }, echecs { };
+  auto essayer = [&](const string& nom, size_t x, size_t y,
+      const string& texte, size_t cote, const Position& source,
+      const Position& but) {
+    ++suivis;
+    if (!suivre(nom, x, y, placer(texte, x, source), cote, source, but)) {
+      ++echecs;
+    }
+  };
+
+  // 10 x 34 ouverte et fermee : le rat allait et venait entre (3,14) et (3,15)
+  {
+    const size_t x = 10, y = 34;
+    string texte(x * y, VIDE);
+    for (size_t j = 0; j != y; ++j) {
+      for (size_t i = 0; i != x; ++i) {
+        if (i == 0 || j == 0 || i + 1 == x || j + 1 == y) {
+          texte[j * x + i] = MUR;
+        }
+      }
+    }
+    texte[14 * x + 8] = FROMAGE;
+    essayer("ouverte-10x34", x, y, texte, 4, Position { 3, 15 },
+        Position { 8, 14 });
+  }
+
+  mt19937 alea { graine };
+  const char* noms[] { "ouverte", "labyrinthe", "salles" };
+  for (size_t n = 0; n != cartes; ++n) {
+    MapGenerator::Parametres p { };
+    p.topologie = static_cast<MapGenerator::Topologie>(n % 3);
+    p.largeur = 10 + alea() % 40;
+    p.hauteur = 10 + alea() % 40;
+    p.salle = 6;
+    p.rats = 1;
+    p.chats = 0;
+    p.fromages = 8;
+    p.sorties = 0; // un rat sur une sortie quitterait la carte
+    p.graine = alea();
+    MapGenerator generateur { p };
+    if (!generateur.Generate()) {
+      continue;
+    }
+    auto texte = generateur.str();
+    texte.erase(remove(begin(texte), end(texte), '\n'), end(texte));
+    auto nom = string { noms[p.topologie] } + '-' + to_string(p.largeur) + 'x'
+        + to_string(p.hauteur) + '-' + to_string(p.graine);
+    vector<Position> libres, fromages;
+    for (size_t j = 0; j != p.hauteur; ++j) {
+      for (size_t i = 0; i != p.largeur; ++i) {
+        Position pos { static_cast<int>(i), static_cast<int>(j) };
+        auto c = texte[j * p.largeur + i];
+        if (c == FROMAGE) {
+          fromages.push_back(pos);
+        } else if (c == VIDE || c == RAT) {
+          libres.push_back(pos);
+        }
+      }
+    }
+    for (auto cote : { 4, 8 }) {
+      for (auto& but : fromages) {
+        essayer(nom, p.largeur, p.hauteur, texte, cote,
+            libres[alea() % libres.size()], but);
+      }
+    }
+  }
+  cout << suivis << " chemins suivis, " << echecs << " echecs" << endl;
+  return echecs ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+#include "event_log.h"
+#include "map.h"
+#include "wire.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+const char event_log_magic[] = { 'E', 'V', 'L', 'G' };
+const size_t header_size = 1 + 8 + 4; // kind, time, payload size
+
+atomic<uint64_t> next_log_id { 1 };
+
+size_t round_up(size_t n) {
+  size_t p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+}
+
+event_log::ring::ring(size_t capacity)
+    : bytes(capacity), mask { capacity - 1 }, head { }, tail { } {
+}
+
+event_log::event_log(const string& path, milliseconds period, size_t ring)
+    : file_ { path, ios::out | ios::trunc | ios::binary }, open_ { },
+        start_ { steady_clock::now() }, period_ { period },
+        capacity_ { round_up(max<size_t>(ring, 256)) }, id_ { next_log_id++ },
+        stop_ { } {
+  open_ = static_cast<bool>(file_);
+  file_.write(event_log_magic, sizeof event_log_magic);
+  file_.put(static_cast<char>(event_log_format));
+  file_.flush();
+  writer_ = thread { &event_log::run, this };
+}
+
+event_log::~event_log() {
+  {
+    lock_guard<mutex> lock { wake_mutex_ };
+    stop_ = true;
+  }
+  wake_.notify_one();
+  writer_.join();
+  lock_guard<mutex> lock { file_mutex_ };
+  lock_guard<mutex> rings_lock { rings_mutex_ };
+  for (auto& r : rings_) {
+    drain(*r);
+  }
+}
+
+bool event_log::good() const noexcept {
+  return open_;
+}
+
+/*
+ The ring of the calling thread is found through a one-entry thread_local
+ cache, so a thread alternating between two logs registers a new ring at
+ every switch: there is only one log per process.
+ */
+event_log::ring& event_log::local() {
+  thread_local struct {
+    uint64_t id;
+    ring* r;
+  } cache { };
+  if (cache.id != id_) {
+    lock_guard<mutex> lock { rings_mutex_ };
+    rings_.emplace_back(new ring { capacity_ });
+    cache.id = id_;
+    cache.r = rings_.back().get();
+  }
+  return *cache.r;
+}
+
+string& event_log::start(event_kind kind) {
+  thread_local string record;
+  record.clear();
+  wire_writer wr { record };
+  wr.u8(kind);
+  wr.u64(static_cast<uint64_t>(duration_cast<microseconds>(
+      steady_clock::now() - start_).count()));
+  wr.u32(0); // patched by append
+  return record;
+}
+
+void event_log::append(string& record) {
+  if (!open_) {
+    return;
+  }
+  auto size = static_cast<uint32_t>(record.size() - header_size);
+  for (int i = 0; i != 4; ++i) { // little-endian, as wire_writer
+    record[9 + i] = static_cast<char>(size >> (8 * i));
+  }
+  auto& r = local();
+  auto n = record.size();
+  if (n > capacity_ / 2) {
+    lock_guard<mutex> lock { file_mutex_ };
+    drain(r);
+    file_.write(record.data(), static_cast<streamsize>(n));
+    file_.flush();
+    return;
+  }
+  auto tail = r.tail.load(memory_order_relaxed);
+  while (capacity_ - (tail - r.head.load(memory_order_acquire)) < n) {
+    wake_.notify_one(); // full: wait for the writer
+    this_thread::yield();
+  }
+  auto at = tail & r.mask;
+  auto first = min(n, capacity_ - at);
+  memcpy(&r.bytes[at], record.data(), first);
+  memcpy(&r.bytes[0], record.data() + first, n - first);
+  r.tail.store(tail + n, memory_order_release);
+  if (tail + n - r.head.load(memory_order_relaxed) > capacity_ / 2) {
+    wake_.notify_one();
+  }
+}
+
+void event_log::drain(ring& r) {
+  auto head = r.head.load(memory_order_relaxed);
+  auto n = r.tail.load(memory_order_acquire) - head;
+  if (!n) {
+    return;
+  }
+  auto at = head & r.mask;
+  auto first = min(n, capacity_ - at);
+  file_.write(&r.bytes[at], static_cast<streamsize>(first));
+  file_.write(&r.bytes[0], static_cast<streamsize>(n - first));
+  r.head.store(head + n, memory_order_release);
+}
+
+void event_log::run() {
+  unique_lock<mutex> wake_lock { wake_mutex_ };
+  while (!stop_) {
+    wake_.wait_for(wake_lock, period_);
+    wake_lock.unlock();
+    {
+      lock_guard<mutex> lock { file_mutex_ };
+      lock_guard<mutex> rings_lock { rings_mutex_ };
+      for (auto& r : rings_) {
+        drain(*r);
+      }
+      file_.flush();
+    }
+    wake_lock.lock();
+  }
+}
+
+void event_log::cat_ate_rat(int cat, int rat, const Position& pos) {
+  auto& record = start(EV_CHAT_MANGE_RAT);
+  wire_writer wr { record };
+  wr.i32(cat);
+  wr.i32(rat);
+  wr.position(pos);
+  append(record);
+}
+
+void event_log::rat_ate_cheese(int rat, const Position& pos) {
+  auto& record = start(EV_RAT_MANGE_FROMAGE);
+  wire_writer wr { record };
+  wr.i32(rat);
+  wr.position(pos);
+  append(record);
+}
+
+void event_log::rat_exited(int rat, const Position& pos) {
+  auto& record = start(EV_RAT_SORT);
+  wire_writer wr { record };
+  wr.i32(rat);
+  wr.position(pos);
+  append(record);
+}
+
+void event_log::meow(int cat, const Position& pos) {
+  auto& record = start(EV_MIAOU);
+  wire_writer wr { record };
+  wr.i32(cat);
+  wr.position(pos);
+  append(record);
+}
+
+void event_log::map_snapshot(uint64_t ms, bool rle, const string& text) {
+  auto& record = start(EV_CARTE);
+  wire_writer wr { record };
+  wr.u64(ms);
+  wr.u8(rle);
+  record += text;
+  append(record);
+}
+
+void event_log::agent_totals(int rank, uint32_t requested, uint32_t accepted) {
+  auto& record = start(EV_BILAN);
+  wire_writer wr { record };
+  wr.i32(rank);
+  wr.u32(requested);
+  wr.u32(accepted);
+  append(record);
+}
+
+void event_log::game_end(uint64_t ms) {
+  auto& record = start(EV_FIN);
+  wire_writer wr { record };
+  wr.u64(ms);
+  append(record);
+}
+
+void event_log::final_map(bool rle, const string& text) {
+  auto& record = start(EV_CARTE_FINALE);
+  wire_writer wr { record };
+  wr.u8(rle);
+  record += text;
+  append(record);
+}
+
+bool write_report(istream& in, ostream& out, bool expand_rle) {
+  char magic[sizeof event_log_magic + 1];
+  if (!in.read(magic, sizeof magic)
+      || !equal(begin(event_log_magic), end(event_log_magic), magic)
+      || static_cast<uint8_t>(magic[sizeof event_log_magic])
+          != event_log_format) {
+    return false;
+  }
+  string payload, expanded;
+  // the text of a map record, from <rd> to the end of the payload
+  auto map_text = [&](wire_reader& rd, bool rle) {
+    auto n = rd.remaining();
+    auto text = rd.bytes(n);
+    if (rle && expand_rle) {
+      expanded.clear();
+      Map::ExpandRLE(text, n, expanded);
+      out.write(expanded.data(), static_cast<streamsize>(expanded.size()));
+    } else {
+      out.write(text, static_cast<streamsize>(n));
+    }
+  };
+  char header[header_size];
+  while (in.read(header, sizeof header)) {
+    wire_reader hd { header, header + sizeof header };
+    auto kind = hd.u8();
+    hd.u64(); // time stamp, unused by the report
+    payload.resize(hd.u32());
+    if (!in.read(&payload[0], static_cast<streamsize>(payload.size()))) {
+      break;
+    }
+    wire_reader rd { payload };
+    switch (kind) {
+    case EV_CHAT_MANGE_RAT: {
+      auto cat = rd.i32();
+      auto rat = rd.i32();
+      out << "Chat " << cat << " a mangé le rat " << rat << endl;
+      break;
+    }
+    case EV_RAT_MANGE_FROMAGE: {
+      auto rat = rd.i32();
+      out << "Rat " << rat << " a mange un fromage a la position "
+          << rd.position() << endl;
+      break;
+    }
+    case EV_RAT_SORT: {
+      auto rat = rd.i32();
+      out << "Le rat " << rat << " a quitté par la sortie " << rd.position()
+          << endl;
+      break;
+    }
+    case EV_MIAOU: {
+      auto cat = rd.i32();
+      out << "Le processus " << cat << " a fait MIAOUX à " << rd.position()
+          << endl;
+      break;
+    }
+    case EV_CARTE: {
+      out << rd.u64() << "ms depuis la derniere carte" << endl;
+      auto rle = rd.u8() != 0;
+      map_text(rd, rle);
+      out << endl;
+      break;
+    }
+    case EV_BILAN: {
+      auto rank = rd.i32();
+      auto requested = rd.u32();
+      auto accepted = rd.u32();
+      out << "Le processus " << rank << " a fait " << requested
+          << " demandes de mouvements" << endl;
+      out << "----Sa proportion de mouvements acceptés est: "
+          << (double) accepted / requested << endl;
+      break;
+    }
+    case EV_FIN:
+      out << "Le temps total d'éxécution est " << rd.u64() << "ms" << endl;
+      break;
+    case EV_CARTE_FINALE: {
+      auto rle = rd.u8() != 0;
+      map_text(rd, rle);
+      out << endl;
+      break;
+    }
+    default: // unknown kinds are skipped, their size is known
+      break;
+    }
+  }
+  return true;
+}
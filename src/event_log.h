@@ -0,0 +1,113 @@
+/*
+ * event_log.h
+ *
+ * Binary append-only log of the game events, streamed to disk by a
+ * background thread, and the offline rendering of its report.
+ */
+
+#ifndef EVENT_LOG_H_
+#define EVENT_LOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "position.h"
+
+/*
+ Version of the log format, written in the file header.
+ */
+const std::uint8_t event_log_format = 1;
+
+enum event_kind : std::uint8_t {
+  EV_CHAT_MANGE_RAT, // i32 cat, i32 rat, position
+  EV_RAT_MANGE_FROMAGE, // i32 rat, position
+  EV_RAT_SORT, // i32 rat, position
+  EV_MIAOU, // i32 cat, position
+  EV_CARTE, // u64 ms since the previous one, u8 rle, text up to the end
+  EV_BILAN, // i32 rank, u32 requested moves, u32 accepted moves
+  EV_FIN, // u64 ms since the start of the game
+  EV_CARTE_FINALE // u8 rle, text up to the end
+};
+
+/*
+ Every record is u8 kind, u64 microseconds since the log was opened, u32
+ payload size, then the payload written by a wire_writer (see event_kind),
+ after a header "EVLG" + event_log_format.
+
+ Each thread appends to its own ring of bytes, without locking; a background
+ thread drains all the rings to the file every <period>, or sooner when one
+ of them is half full, and flushes it, so a crash only loses the last
+ period. A record too large for a ring (a big map) is written straight to
+ the file by its thread, after draining its own ring to keep its order.
+ Records of different threads are only ordered by their time stamps.
+ */
+class event_log {
+public:
+  explicit event_log(const std::string& path,
+      std::chrono::milliseconds period = std::chrono::milliseconds { 100 },
+      std::size_t ring = 1 << 16);
+  event_log(const event_log&) = delete;
+  // drains every ring and closes the file
+  ~event_log();
+
+  // false if the file could not be opened, every record is then dropped
+  bool good() const noexcept;
+
+  void cat_ate_rat(int cat, int rat, const Position&);
+  void rat_ate_cheese(int rat, const Position&);
+  void rat_exited(int rat, const Position&);
+  void meow(int cat, const Position&);
+  void map_snapshot(std::uint64_t ms, bool rle, const std::string& text);
+  void agent_totals(int rank, std::uint32_t requested, std::uint32_t accepted);
+  void game_end(std::uint64_t ms);
+  void final_map(bool rle, const std::string& text);
+
+private:
+  // single producer (its thread), single consumer (whoever holds file_mutex_)
+  struct ring {
+    explicit ring(std::size_t capacity);
+    std::vector<char> bytes;
+    std::size_t mask;
+    std::atomic<std::size_t> head, tail; // consumed, produced
+  };
+
+  ring& local();
+  // the calling thread's scratch record, header written, payload to append
+  std::string& start(event_kind);
+  void append(std::string& record);
+  void drain(ring&); // #Requires file_mutex_
+  void run();
+
+  std::ofstream file_;
+  bool open_;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::milliseconds period_;
+  std::size_t capacity_;
+  std::uint64_t id_; // tells the thread_local ring caches of two logs apart
+  std::mutex rings_mutex_, file_mutex_, wake_mutex_;
+  std::vector<std::unique_ptr<ring>> rings_;
+  std::condition_variable wake_;
+  bool stop_;
+  std::thread writer_;
+};
+
+/*
+ Writes the human readable report of the log read from <in> (the former
+ diagnostic.txt): the records in the order of the file, the maps as they were
+ logged unless <expand_rle>. Returns false if <in> is not a log; a truncated
+ last record is ignored.
+ */
+bool write_report(std::istream& in, std::ostream& out,
+    bool expand_rle = false);
+
+#endif /* EVENT_LOG_H_ */
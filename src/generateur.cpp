@@ -0,0 +1,154 @@
+/*
+ * generateur.cpp
+ *
+ * Generateur de cartes pour les essais a grande echelle (voir MapGenerator).
+ *
+ * usage : generateur [largeur=n] [hauteur=n] [taille=n]
+ *     [topologie=ouverte|labyrinthe|salles] [murs=pourcentage] [salle=n]
+ *     [rats=n] [chats=n] [fromages=n] [sorties=n] [graine=n] [fichier]
+ *
+ * La carte est ecrite dans <fichier>, ou sur la sortie standard. Avec
+ * corpus=dossier, ecrit dans <dossier> une carte par topologie et par taille
+ * (taille= repetable, 256, 1024 et 4096 par defaut), les elements etant
+ * proportionnels a la surface ; les autres options s'appliquent a toutes.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mapgenerator.h"
+
+using namespace std;
+
+namespace {
+
+struct options {
+  MapGenerator::Parametres parametres;
+  vector<size_t> tailles;
+  bool rats, chats, fromages, sorties; // donnes explicitement
+  string fichier, corpus;
+};
+
+bool lire_topologie(const string& nom, MapGenerator::Topologie& t) {
+  if (nom == "ouverte") {
+    t = MapGenerator::OUVERTE;
+  } else if (nom == "labyrinthe") {
+    t = MapGenerator::LABYRINTHE;
+  } else if (nom == "salles") {
+    t = MapGenerator::SALLES;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool lire_options(int argc, char* argv[], options& o) {
+  auto& p = o.parametres;
+  auto valeur = [](const string& arg, const char* cle, size_t& n) {
+    auto l = char_traits<char>::length(cle);
+    if (arg.compare(0, l, cle) != 0) {
+      return false;
+    }
+    n = static_cast<size_t>(strtoul(arg.c_str() + l, nullptr, 10));
+    return true;
+  };
+  for (int i = 1; i < argc; ++i) {
+    string arg { argv[i] };
+    size_t n;
+    if (valeur(arg, "largeur=", p.largeur) || valeur(arg, "hauteur=", p.hauteur)
+        || valeur(arg, "salle=", p.salle)) {
+    } else if (valeur(arg, "taille=", n)) {
+      p.largeur = p.hauteur = n;
+      o.tailles.push_back(n);
+    } else if (arg.compare(0, 10, "topologie=") == 0) {
+      if (!lire_topologie(arg.substr(10), p.topologie)) {
+        cerr << "topologie inconnue : " << arg.substr(10) << endl;
+        return false;
+      }
+    } else if (arg.compare(0, 5, "murs=") == 0) {
+      p.murs = atoi(arg.c_str() + 5);
+    } else if (valeur(arg, "rats=", p.rats)) {
+      o.rats = true;
+    } else if (valeur(arg, "chats=", p.chats)) {
+      o.chats = true;
+    } else if (valeur(arg, "fromages=", p.fromages)) {
+      o.fromages = true;
+    } else if (valeur(arg, "sorties=", p.sorties)) {
+      o.sorties = true;
+    } else if (valeur(arg, "graine=", n)) {
+      p.graine = static_cast<uint32_t>(n);
+    } else if (arg.compare(0, 7, "corpus=") == 0) {
+      o.corpus = arg.substr(7);
+    } else if (arg.find('=') == string::npos) {
+      o.fichier = arg;
+    } else {
+      cerr << "option inconnue : " << arg << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool generer(const MapGenerator::Parametres& p, const string& fichier) {
+  MapGenerator g { p };
+  if (!g.Generate()) {
+    cerr << p.largeur << 'x' << p.hauteur
+        << " : dimensions hors limites ou pas assez de cases libres" << endl;
+    return false;
+  }
+  if (fichier.empty()) {
+    g.Write(cout);
+  } else {
+    ofstream out { fichier, ios::binary };
+    g.Write(out);
+    if (!out) {
+      cerr << fichier << " : ecriture impossible" << endl;
+      return false;
+    }
+  }
+  cerr << (fichier.empty() ? "-" : fichier) << " : " << p.largeur << 'x'
+      << p.hauteur << ", " << g.getWallRatio() << " % de murs, "
+      << g.getExitCount() << " sorties" << endl;
+  return true;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  options o { };
+  if (!lire_options(argc, argv, o)) {
+    return 1;
+  }
+  if (o.corpus.empty()) {
+    return generer(o.parametres, o.fichier) ? 0 : 1;
+  }
+
+  if (o.tailles.empty()) {
+    o.tailles = { 256, 1024, 4096 };
+  }
+  const struct {
+    const char* nom;
+    MapGenerator::Topologie topologie;
+  } topologies[] { { "ouverte", MapGenerator::OUVERTE }, { "labyrinthe",
+      MapGenerator::LABYRINTHE }, { "salles", MapGenerator::SALLES } };
+  for (auto taille : o.tailles) {
+    for (auto& t : topologies) {
+      auto p = o.parametres;
+      p.largeur = p.hauteur = taille;
+      p.topologie = t.topologie;
+      // un rat pour 400 cases, un chat pour 4000, un fromage pour 1000, une
+      // sortie pour 100 cases de bordure
+      auto surface = taille * taille;
+      p.rats = o.rats ? p.rats : surface / 400;
+      p.chats = o.chats ? p.chats : surface / 4000 + 1;
+      p.fromages = o.fromages ? p.fromages : surface / 1000 + 1;
+      p.sorties = o.sorties ? p.sorties : taille / 25 + 1;
+      if (!generer(p, o.corpus + '/' + t.nom + '-' + to_string(taille))) {
+        return 1;
+      }
+    }
+  }
+}
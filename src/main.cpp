@@ -1,20 +1,32 @@
+#include <algorithm>
 #include <chrono>
+#include <deque>
 #include <future>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <string>
-#include <sstream>
 #include <thread>
 #include <vector>
 
+#include "event_log.h"
 #include "mpi.h"
 #include "map.h"
+#include "mpsc_queue.h"
 #include "position.h"
+#include "shared_map.h"
+#include "thread_pool.h"
+#include "wire.h"
 
 using namespace std;
 using namespace std::chrono;
 
 using Args = vector<string>;
 
+// un rat a moins de portee_miaou cases d'un chat qui miaule panique
+const int portee_miaou = 8;
+
 struct rat_etat {
   bool panique;
   int alzheimer;
@@ -31,85 +43,536 @@ struct Compt {
   }
 };
 
-stringstream statistique;
+// carte gardee par un Joueur d'un message MMT_DO a l'autre
+struct joueur_etat {
+  unique_ptr<Map> carte;
+  bool sync; // une carte complete a ete demandee a la racine
+  shared_map* partage; // carte publiee en memoire partagee, si disponible
+  size_t hpa; // cote des clusters de la couche hierarchique, 0 sans
+  // repond a la racine (<msg>) par le coup de l'agent en <curr>
+  function<void(const mpi_message& msg, const Position& curr)> jouer;
+  joueur_etat()
+      : carte { }, sync { }, partage { }, hpa { }, jouer { } {
+  }
+};
 
-// setup the endpoint to be chasseur
-void init_chasseur(const mpi_server& mpi, mpi_endpoint& ep) {
-  ep.add_handler(MMT_DO, [&](const mpi_message& msg) {
-    if (mpi.probe(msg)) {
-      return;
+// options after the root's arguments, forwarded as is to the Joueurs
+struct options {
+  bool shm; // publish the map in shared memory (every process on one node)
+  milliseconds tick; // moves applied in batches, with this deadline, if not 0
+  size_t threads; // threads of the root, counting the one applying the moves
+  bool local; // agents run as tasks of the root's threads, nothing is spawned
+  bool bcast; // the map goes to every Joueur at once by a collective
+  bool rle; // run-length encoded map snapshots in diagnostic.txt
+  size_t hpa; // agents step through the hierarchical layer, clusters of hpa
+  options()
+      : shm { }, tick { }, threads { 1 }, local { }, bcast { }, rle { },
+          hpa { } {
+  }
+};
+
+// a move request waiting for the end of the tick
+struct demande {
+  int rank;
+  Position cour, dest;
+};
+
+options lire_options(Args::const_iterator debut, Args::const_iterator fin) {
+  options o { };
+  for (; debut != fin; ++debut) {
+    if (*debut == "shm") {
+      o.shm = true;
+    } else if (*debut == "tick") {
+      o.tick = milliseconds { 50 };
+    } else if (debut->compare(0, 5, "tick=") == 0) {
+      o.tick = milliseconds { max(1, atoi(debut->c_str() + 5)) };
+    } else if (*debut == "bcast") {
+      o.bcast = true;
+    } else if (*debut == "local") {
+      o.local = true;
+    } else if (*debut == "rle") {
+      o.rle = true;
+    } else if (*debut == "hpa") {
+      o.hpa = 16;
+    } else if (debut->compare(0, 4, "hpa=") == 0) {
+      o.hpa = static_cast<size_t>(max(2, atoi(debut->c_str() + 4)));
+    } else if (debut->compare(0, 8, "threads=") == 0) {
+      o.threads = static_cast<size_t>(max(1, atoi(debut->c_str() + 8)));
+    } else {
+      cerr << "option inconnue : " << *debut << endl;
+    }
+  }
+  return o;
+}
+
+// shared map publication, if every process is on this node
+// #Collective-call over <intra>, the intercommunicator merged root first
+unique_ptr<shared_map> partager_carte(const mpi_server& mpi, MPI_Comm intra,
+    const Map* map) {
+  if (!mpi.same_node(intra)) {
+    return nullptr;
+  }
+  return unique_ptr<shared_map> { new shared_map { intra, map } };
+}
+
+// evenements de la partie, ecrits au fil de l'eau dans diagnostic.bin puis
+// mis en forme dans diagnostic.txt (voir l'outil rapport)
+unique_ptr<event_log> journal;
+
+// rendu de la carte pour le journal, recycle d'une copie a l'autre
+string rendu;
+bool rendu_rle = false; // voir Map::RenderRLE
+
+const string& rendre_carte(const Map& map) {
+  if (rendu_rle) {
+    map.RenderRLE(rendu);
+  } else {
+    map.Render(rendu);
+  }
+  return rendu;
+}
+
+// version d'une carte qu'un agent n'a pas encore recue
+const Map::version_type sans_version = numeric_limits<Map::version_type>::max();
+
+// encode des positions pour le commentaire d'un mpi_message™, a la suite de
+// <s> (typiquement un tampon recycle par mpi_endpoint::acquire_buffer)
+string encoder(initializer_list<Position> positions, string s = { }) {
+  wire_writer wr { s };
+  for (auto& p : positions) {
+    wr.position(p);
+  }
+  return s;
+}
+
+// corps d'un message MMT_DO pour un agent qui connait la version <connue>:
+// la version seulement si la carte est en memoire partagee, les cases
+// modifiees depuis si le journal de la carte le permet, sinon la carte
+// complete
+void corps_carte(wire_writer& wr, const Map& map, Map::version_type connue,
+    const shared_map* partage) {
+  vector<Map::Changement> delta;
+  if (partage) {
+    wr.u8('V');
+    wr.u64(map.getVersion());
+  } else if (map.ChangesSince(connue, delta)) {
+    wr.u8('D');
+    wr.u64(connue);
+    wr.u64(map.getVersion());
+    wr.u32(static_cast<uint32_t>(delta.size()));
+    auto x = map.getSizeX();
+    for (auto& c : delta) {
+      wr.u32(static_cast<uint32_t>(c.pos.getY() * x + c.pos.getX()));
+      wr.u8(wire_encode_cell(c.cell));
     }
+  } else {
+    map.Encode(wr);
+  }
+}
+
+// message MMT_DO complet pour l'agent en <pos>
+string message_carte(const Map& map, const Position& pos,
+    Map::version_type connue, const shared_map* partage) {
+  string s {};
+  wire_writer wr { s };
+  wr.position(pos);
+  corps_carte(wr, map, connue, partage);
+  return s;
+}
 
-    stringstream mapss {};
-    mapss << msg.comment;
-    Position curr;
-    mapss >> curr;
-    Map map {mapss};
-    auto cibles = map.getListeRat();
-    Position dest = map.AStarShortestPathForDestinationSet(curr, cibles);
-    stringstream positions {};
-    positions << dest;
-    auto closestRat = map.GetClosestsDestination(curr, map.getListeRat());
-    auto closestRatDist = map.ManhattanDistance(curr, closestRat);
-    if (closestRatDist < 11) {
-      ep.reply(msg, MMT_SPECIAL, positions.str());
+// met a jour la carte du Joueur depuis le corps d'un message MMT_DO,
+// retourne faux si la carte ne peut pas etre utilisee (version manquante)
+bool recevoir_carte(mpi_endpoint& ep, const mpi_message& msg, joueur_etat& je,
+    wire_reader& rd) {
+  if (rd.peek() == 'V') {
+    rd.u8();
+    auto version = rd.u64();
+    je.partage->read(je.carte);
+    return rd.good() && je.carte->getVersion() >= version;
+  }
+  if (rd.peek() == 'M') {
+    if (je.carte) {
+      je.carte->Decode(rd); // reuses the grid already allocated
+    } else {
+      je.carte.reset(new Map { rd });
     }
-    positions << curr;
-    ep.reply(msg, positions.str());
-  });
+    je.sync = false;
+    if (!rd.good()) {
+      je.carte.reset();
+    }
+    return rd.good();
+  }
+  rd.u8(); // 'D'
+  auto base = rd.u64();
+  auto version = rd.u64();
+  auto n = rd.u32();
+  if (!rd.good() || !je.carte || je.carte->getVersion() != base) {
+    if (!je.sync) {
+      ep.reply(msg, MMT_SYNC, { });
+      je.sync = true;
+    }
+    return false;
+  }
+  auto x = static_cast<uint32_t>(je.carte->getSizeX());
+  for (; n && rd.good(); --n) {
+    auto i = rd.u32();
+    auto cell = wire_decode_cell(rd.u8());
+    Position pos { static_cast<Position::coord_type>(i % x),
+        static_cast<Position::coord_type>(i / x) };
+    je.carte->Apply(Map::Changement { version, pos, cell });
+  }
+  je.carte->setVersion(version);
+  return rd.good();
 }
 
-// setup the endpoint to be rat
-void init_rat(const mpi_server& mpi, mpi_endpoint& ep, rat_etat& re) {
+// construit (option hpa) ou repare la couche hierarchique de <map>
+void preparer_hierarchie(Map& map, size_t cote) {
+  if (!cote) {
+    return;
+  }
+  if (map.hasHierarchy()) {
+    map.RepairHierarchy();
+  } else {
+    map.EnableHierarchy(cote);
+  }
+}
+
+/*
+ Option hpa : premier pas par la couche hierarchique vers la cible la plus
+ proche a vol d'oiseau, ou <pos> si elle est hors d'atteinte ; l'agent joue
+ alors comme sans l'option.
+ \pre preparer_hierarchie depuis le dernier changement de <map>
+ */
+Position pas_hierarchique(const Map& map, const Position& pos,
+    Map::Cible cible) {
+  Position but;
+  if (!map.getSpatialIndex(cible).nearest(pos, but)) {
+    return pos;
+  }
+  return map.HierarchicalShortestPath(pos, but);
+}
+
+// setup the endpoint to be chasseur
+void init_chasseur(mpi_endpoint& ep, joueur_etat& je) {
+  je.jouer = [&](const mpi_message& msg, const Position& curr) {
+    auto& map = *je.carte;
+    Position dest = curr;
+    if (je.hpa) {
+      preparer_hierarchie(map, je.hpa);
+      dest = pas_hierarchique(map, curr, Map::CIBLE_RAT);
+    }
+    if (dest == curr) {
+      dest = map.AStarShortestPathForDestinationSet(curr, map.getListeRat());
+    }
+    Position closestRat;
+    if (map.getSpatialIndex(Map::CIBLE_RAT).nearest(curr, closestRat)
+        && map.ManhattanDistance(curr, closestRat) < 11) {
+      ep.reply(msg, MMT_SPECIAL, encoder( {dest}, ep.acquire_buffer()));
+    }
+    ep.reply(msg, encoder( {dest, curr}, ep.acquire_buffer()));
+  };
   ep.add_handler(MMT_DO, [&](const mpi_message& msg) {
-    if (mpi.probe(msg)) {
-      return;
+    wire_reader rd {msg.comment};
+    Position curr = rd.position();
+    // every delta must be applied, only the latest one gets a reply
+    if (recevoir_carte(ep, msg, je, rd) && msg.latest) {
+      je.jouer(msg, curr);
     }
-    stringstream mapss {};
-    mapss << msg.comment;
-    Position curr;
-    mapss >> curr;
-    Map map {mapss};
+  });
+}
+
+// setup the endpoint to be rat
+void init_rat(mpi_endpoint& ep, rat_etat& re, joueur_etat& je) {
+  je.jouer = [&](const mpi_message& msg, const Position& curr) {
+    auto& map = *je.carte;
     if (--re.alzheimer < 1) {
       re.panique = false;
     }
-    auto cibles = re.panique ? map.getListeSortie() : map.getListeFromage();
-    Position dest = map.AStarShortestPathForDestinationSet(curr, cibles);
-    stringstream positions {};
-    positions << dest << curr;
-    ep.reply(msg, positions.str());
-  });
-  ep.add_handler(MMT_SPECIAL, [&](const mpi_message& msg) {
-    Position chat, moi;
-    stringstream sss {};
-    sss << msg.comment;
-    sss >> chat >> moi;
-    Map map {sss};
-    auto distance = map.ManhattanDistance(chat, moi);
-    if (distance < 8) {
-      re.panique = true;
-      re.alzheimer = 5;
+    // the distance fields survive between turns as long as the cheeses
+    // (or the exits, which never change) stay the same
+    auto cible = re.panique ? Map::CIBLE_SORTIE : Map::CIBLE_FROMAGE;
+    Position dest = curr;
+    if (je.hpa) {
+      preparer_hierarchie(map, je.hpa);
+      dest = pas_hierarchique(map, curr, cible);
+    }
+    if (dest == curr) {
+      dest = map.NextStepOnField(curr, cible);
     }
+    ep.reply(msg, encoder( {dest, curr}, ep.acquire_buffer()));
+  };
+  ep.add_handler(MMT_DO, [&](const mpi_message& msg) {
+    wire_reader rd {msg.comment};
+    Position curr = rd.position();
+    // every delta must be applied, only the latest one gets a reply
+    if (recevoir_carte(ep, msg, je, rd) && msg.latest) {
+      je.jouer(msg, curr);
+    }
+  });
+  // the root only alerts the rats within earshot of the cat
+  ep.add_handler(MMT_SPECIAL, [&](const mpi_message&) {
+    re.panique = true;
+    re.alzheimer = 5;
+  });
+}
+
+/*
+ Diffusion collective de la carte (option bcast), sur l'intercommunicateur
+ fusionne dont la racine est le rang 0 : par MPI_Ibcast, l'entete (la taille
+ de la charge) puis la charge :
+   'B', fin (u8), n (u32), n x (rang i32, position), corps de carte
+ ou la table donne la position de chaque agent vivant et le corps (voir
+ corps_carte) part de la version de la diffusion precedente. Chaque Joueur,
+ meme mange, prend part a toutes les diffusions jusqu'a celle marquee fin.
+ */
+struct diffusion {
+  uint32_t taille;
+  string charge;
+  MPI_Request requetes[2];
+  int en_cours; // racine : requetes pas encore terminees
+};
+
+// prochaine diffusion pour un Joueur : l'entete, puis la charge
+void attendre_diffusion(mpi_server& mpi, mpi_endpoint& ep, joueur_etat& je,
+    diffusion& d, MPI_Comm intra);
+
+void recevoir_diffusion(mpi_server& mpi, mpi_endpoint& ep, joueur_etat& je,
+    diffusion& d, MPI_Comm intra) {
+  d.charge.resize(d.taille);
+  MPI_Ibcast(d.taille ? &d.charge[0] : nullptr, d.taille, MPI_CHAR, 0, intra,
+      &d.requetes[1]);
+  ep.watch(d.requetes[1], [&mpi, &ep, &je, &d, intra] {
+    wire_reader rd {d.charge};
+    rd.u8(); // 'B'
+      bool fin = rd.u8();
+      auto n = rd.u32();
+      bool vivant = false;
+      Position curr { };
+      for (; n && rd.good(); --n) {
+        auto rang = rd.i32();
+        auto pos = rd.position();
+        if (rang == mpi.rank()) {
+          vivant = true;
+          curr = pos;
+        }
+      }
+      if (fin) {
+        ep.request_stop();
+        return;
+      }
+      // replies go to the root point to point, as for MMT_DO
+      mpi_message racine {};
+      racine.comm = mpi.parent();
+      racine.tag = MMT_DO;
+      bool carte = recevoir_carte(ep, racine, je, rd);
+      MPI_Ibcast(&d.taille, 1, MPI_UINT32_T, 0, intra, &d.requetes[0]);
+      int deja { };
+      MPI_Test(&d.requetes[0], &deja, MPI_STATUS_IGNORE);
+      if (deja) {
+        recevoir_diffusion(mpi, ep, je, d, intra); // this map is already stale
+        return;
+      }
+      if (vivant && carte && je.jouer) {
+        je.jouer(racine, curr);
+      }
+      ep.watch(d.requetes[0], [&mpi, &ep, &je, &d, intra] {
+            recevoir_diffusion(mpi, ep, je, d, intra);
+          });
+    });
+}
+
+void attendre_diffusion(mpi_server& mpi, mpi_endpoint& ep, joueur_etat& je,
+    diffusion& d, MPI_Comm intra) {
+  MPI_Ibcast(&d.taille, 1, MPI_UINT32_T, 0, intra, &d.requetes[0]);
+  ep.watch(d.requetes[0], [&mpi, &ep, &je, &d, intra] {
+    recevoir_diffusion(mpi, ep, je, d, intra);
   });
 }
 
 void SUICIDE_COLLECTIF(mpi_server& mpi, const mpi_unique_comm& space,
     mpi_endpoint& ep, const mpi_message& msg,
-    const map<int, Position>& lookupTable) {
+    const AgentRegistry& agents) {
   cout << mpi << "SUICIDE_COLLECTIF" << endl;
-  for (auto p : lookupTable) {
-    ep.reply(msg, p.first, MMT_STOP, { });
+  for (auto r : agents.ranks()) {
+    ep.reply(msg, r, MMT_STOP, { });
   }
   ep.request_stop();
 }
-void EXTERMINER(mpi_endpoint& ep, const map<int, Position>& lookupTable,
-    const Position& pos, const mpi_message& msg) {
-  for (auto p : lookupTable) {
-    if (p.second == pos) {
-      cout << "EXTERMINATED " << p.first << " " << pos << endl;
-      ep.reply(msg, p.first, MMT_STOP, { });
-      break;
+void EXTERMINER(mpi_endpoint& ep, int rang, const Position& pos,
+    const mpi_message& msg) {
+  cout << "EXTERMINATED " << rang << " " << pos << endl;
+  ep.reply(msg, rang, MMT_STOP, { });
+}
+
+const int sans_rang = AgentRegistry::aucun; // voir Map::getRankPosition
+
+// issue d'un mouvement arbitre par la racine
+struct issue {
+  int disparu; // rang du rat mange ou sorti par ce mouvement, sinon sans_rang
+  Position ou; // sa derniere position
+  bool fin; // plus de rats ou plus de fromages
+  bool accepte; // l'agent a bouge ou il voulait (ou est sorti)
+};
+
+// applique le mouvement demande par un agent, tient ses compteurs et copie
+// la carte dans le journal au plus une fois par seconde
+issue arbitrer(Map& map, Compt& c, const Position& posCour,
+    const Position& posDest, system_clock::time_point& dernier_map_stat) {
+  Map::Disparu disparu;
+  Position newPos = map.Move(posCour, posDest, journal.get(), &disparu);
+  // rester sur place (aucune cible atteignable) ne change pas la carte : le
+  // coup est refuse, rien n'est a diffuser
+  auto accepte = newPos == posDest && posDest != posCour;
+  ++c.nbDemandes;
+  if (accepte) {
+    ++c.nbMouvAcceptes;
+  }
+  auto maintenant = system_clock::now();
+  auto diff_temps = maintenant - dernier_map_stat;
+  auto diff_secondes = duration_cast<seconds>(diff_temps).count();
+  if (diff_secondes > 0) {
+    journal->map_snapshot(static_cast<uint64_t>(
+        duration_cast<milliseconds>(diff_temps).count()), rendu_rle,
+        rendre_carte(map));
+    dernier_map_stat = maintenant;
+  }
+
+  return issue { disparu.rang, disparu.ou, map.getListeRat().empty()
+      || map.getListeFromage().empty(), accepte };
+}
+
+// un coup propose par un agent en mode local
+struct coup {
+  int rang;
+  Position cour, dest;
+  bool miaou; // chat a moins de 11 cases d'un rat
+};
+
+/*
+ Partie sans processus Joueurs. A chaque tour, les agents vivants sont des
+ taches du thread_pool : ils lisent une vue de la carte figee pour le tour
+ (rattrapee par le journal des changements, ses champs de distances et sa
+ couche hierarchique recalcules avant le tour) et deposent leur coup dans une file sans verrou.
+ Ce fil-ci arbitre les coups au fur et a mesure qu'ils arrivent, selon les
+ memes regles que pour les Joueurs ; les miaulements font paniquer les rats
+ a la fin du tour.
+ */
+void partie_locale(Map& map, thread_pool& pool, Compt* m,
+    system_clock::time_point& dernier_map_stat, size_t hpa) {
+  auto& agents = map.getAgents();
+  vector<rat_etat> etats(agents.size());
+  mpsc_queue<coup> file { agents.size() };
+  Map vue { map };
+  vector<Map::Changement> delta;
+  vector<int> rangs;
+  vector<Position> positions, miaous, proches;
+
+  const Map& lue = vue; // les taches ne font que lire la vue
+  function<void(size_t)> agir = [&](size_t i) {
+    auto pos = positions[i];
+    coup c { rangs[i], pos, pos, false };
+    if (lue.showPosition(pos) == CHAT) {
+      if (hpa) {
+        c.dest = pas_hierarchique(lue, pos, Map::CIBLE_RAT);
+      }
+      if (c.dest == pos) {
+        c.dest = lue.AStarShortestPathForDestinationSet(pos,
+            lue.getListeRat());
+      }
+      Position closestRat;
+      c.miaou = lue.getSpatialIndex(Map::CIBLE_RAT).nearest(pos, closestRat)
+          && Map::ManhattanDistance(pos, closestRat) < 11;
+    } else {
+      auto& re = etats[c.rang];
+      if (--re.alzheimer < 1) {
+        re.panique = false;
+      }
+      auto cible = re.panique ? Map::CIBLE_SORTIE : Map::CIBLE_FROMAGE;
+      if (hpa) {
+        c.dest = pas_hierarchique(lue, pos, cible);
+      }
+      if (c.dest == pos) {
+        c.dest = lue.NextStepOnField(pos, cible);
+      }
+    }
+    file.push(c); // un coup par agent et par tour, la file ne deborde pas
+  };
+
+  for (bool fin = false; !fin;) {
+    delta.clear();
+    if (map.ChangesSince(vue.getVersion(), delta)) {
+      for (auto& c : delta) {
+        vue.Apply(c);
+      }
+      vue.setVersion(map.getVersion());
+    } else {
+      vue = map;
     }
+    vue.getDistanceField(Map::CIBLE_FROMAGE);
+    vue.getDistanceField(Map::CIBLE_SORTIE);
+    preparer_hierarchie(vue, hpa);
+    rangs.clear();
+    positions.clear();
+    for (auto r : agents.ranks()) {
+      rangs.push_back(r);
+      positions.push_back(agents.position(r));
+    }
+
+    pool.launch(rangs.size(), agir);
+    coup c;
+    for (bool tous = false; !tous;) {
+      tous = pool.done(); // avant de vider la file : aucun coup n'est perdu
+      while (file.pop(c)) {
+        if (c.miaou) {
+          journal->meow(c.rang, c.dest);
+          miaous.push_back(c.dest);
+        }
+        if (fin || !agents.alive(c.rang)) {
+          continue; // partie finie ou rat mange plus tot dans le tour
+        }
+        auto r = arbitrer(map, m[c.rang], c.cour, c.dest, dernier_map_stat);
+        if (r.disparu != sans_rang) {
+          cout << "EXTERMINATED " << r.disparu << " " << r.ou << endl;
+        }
+        fin = r.fin;
+      }
+      if (!tous) {
+        this_thread::yield();
+      }
+    }
+    pool.wait();
+
+    for (auto& chat : miaous) {
+      map.getSpatialIndex(Map::CIBLE_RAT).within(chat, portee_miaou, proches);
+    }
+    for (auto& p : proches) {
+      auto& re = etats[map.getRankPosition(p)];
+      re.panique = true;
+      re.alzheimer = 5;
+    }
+    miaous.clear();
+    proches.clear();
+  }
+}
+
+// termine le journal par les compteurs des agents et la carte finale, puis
+// le met en forme dans diagnostic.txt
+void ecrire_diagnostic(const Compt* m, int nb_agents,
+    system_clock::time_point debut_root, const Map& map) {
+  for (int rang = 0; rang != nb_agents; ++rang) {
+    journal->agent_totals(rang, static_cast<uint32_t>(m[rang].nbDemandes),
+        static_cast<uint32_t>(m[rang].nbMouvAcceptes));
+  }
+  auto diff_temps = system_clock::now() - debut_root;
+  journal->game_end(static_cast<uint64_t>(
+      duration_cast<milliseconds>(diff_temps).count()));
+  journal->final_map(rendu_rle, rendre_carte(map));
+  journal.reset(); // vide les tampons et ferme diagnostic.bin
+
+  ifstream lu("diagnostic.bin", ios::binary);
+  ofstream fichier("diagnostic.txt", ios::out | ios::trunc);
+  if (!fichier || !write_report(lu, fichier)) {
+    cerr << "Erreur à l'ouverture !" << endl;
   }
 }
 
@@ -130,9 +593,28 @@ int main(int argc, char **argv) {
     if (args[1] == "Joueur") {
       MPI_Barrier(mpi.parent());
       // Joueur process
+      auto opts = lire_options(begin(args) + 2, end(args));
       rat_etat re { };
+      joueur_etat je { };
+      je.hpa = opts.hpa;
+      mpi_local_comm intra;
+      unique_ptr<shared_map> partage;
+      diffusion d { };
+      if (opts.shm || opts.bcast) {
+        intra.comm = mpi.merge(mpi.parent(), true);
+      }
+      if (opts.shm) {
+        partage = partager_carte(mpi, intra.comm, nullptr);
+        je.partage = partage.get();
+      }
+      if (opts.bcast) {
+        attendre_diffusion(mpi, ep, je, d, intra.comm);
+      }
       // add an handler to be remotely stopped
       ep.add_handler(MMT_STOP, [&](const mpi_message&) {
+          if (opts.bcast) {
+            return; // stopped by the last broadcast, see diffusion
+          }
 #if MPI_VERBOSE
           cout << mpi << "Je meurt!" << endl;
 #endif
@@ -142,12 +624,12 @@ int main(int argc, char **argv) {
       // add an handler to setup ourselves
       ep.add_handler(MMT_BECOME, [&](const mpi_message& msg) {
         if (msg.comment == "R") {
-          init_rat(mpi, ep, re);
+          init_rat(ep, re, je);
           string t {"Je suis un init_rat! -"};
           t.append(mpi.id());
           ep.reply(msg, move(t));
         } else if (msg.comment == "C") {
-          init_chasseur(mpi, ep);
+          init_chasseur(ep, je);
           string t {"Je suis un chasseur! -"};
           t.append(mpi.id());
           ep.reply(msg, move(t));
@@ -163,144 +645,335 @@ int main(int argc, char **argv) {
 
     // fail if invoked incorrectly
     if (argc < 4) {
-      cerr << mpi << "<path carte> <|chasseurs|> <|rats|>" << endl;
+      cerr << mpi
+          << "<path carte> <|chasseurs|> <|rats|> [shm] [tick[=ms]] [threads=n] [local] [bcast] [rle] [hpa[=cote]]"
+          << endl;
       return 1;
     }
+    auto opts = lire_options(begin(args) + 4, end(args));
+    rendu_rle = opts.rle;
+    if (opts.threads > 1 && mpi.thread_level() < MPI_THREAD_FUNNELED) {
+      cerr << mpi << "MPI_THREAD_FUNNELED non supporte, un seul thread" << endl;
+      opts.threads = 1;
+    }
+    // serializes the messages, the sends are still posted by this thread
+    thread_pool pool { opts.threads };
 
-    // fail if the map can't be openned
-    ifstream myfile(args[1]);
-    if (!myfile.is_open()) {
+    // init Map and |processes|, fail if the map can't be openned
+    Map map;
+    if (!map.Load(args[1])) {
       cerr << mpi << args[1] << " : carte pas ouvrable" << endl;
       return 1;
     }
-
-    // init Map and |processes|
-    Map map { myfile };
+    journal.reset(new event_log { "diagnostic.bin" });
+    if (!journal->good()) {
+      cerr << mpi << "diagnostic.bin : journal pas ouvrable" << endl;
+    }
     int qty_c { atoi(argv[2]) }, qty_r { atoi(argv[3]) };
-    unique_ptr<Compt[]> m { new Compt[map.getLookupTable().size()] }; // clean up automatically
+    auto& agents = map.getAgents();
+    auto nb_agents = static_cast<int>(agents.size());
+    unique_ptr<Compt[]> m { new Compt[nb_agents] }; // clean up automatically
+    // version of the map last sent to each agent
+    vector<Map::version_type> connues(agents.size(), sans_version);
 
     // decl a self disconnecting communicator
     mpi_unique_comm space;
     auto debut_root = system_clock::now();
     auto dernier_map_stat = debut_root;
 
-    // if all spawns are OK
-    if (!mpi.spawn(qty_r + qty_c, argv[0], vector<char*> {
-        const_cast<char*>("Joueur"), nullptr }, &space.comm)) {
+    // the Joueurs get the same options
+    vector<char*> joueur_args { const_cast<char*>("Joueur") };
+    for (int i = 4; i < argc; ++i) {
+      joueur_args.push_back(argv[i]);
+    }
+    joueur_args.push_back(nullptr);
+
+    if (opts.local) {
+      partie_locale(map, pool, m.get(), dernier_map_stat, opts.hpa);
+      cout << map << endl;
+      ecrire_diagnostic(m.get(), nb_agents, debut_root, map);
+    } else if (!mpi.spawn(qty_r + qty_c, argv[0], move(joueur_args), &space.comm)) {
+      // all spawns are OK
 
       MPI_Barrier(space.comm);
-      for (auto r : map.getLookupTable()) {
-        mpi.send_message(space.comm, r.first, MMT_BECOME,
-            string { map.showPosition(r.second) });
+      mpi_local_comm intra;
+      unique_ptr<shared_map> partage;
+      if (opts.shm || opts.bcast) {
+        intra.comm = mpi.merge(space.comm, false);
+      }
+      if (opts.shm) {
+        partage = partager_carte(mpi, intra.comm, &map);
+        if (!partage) {
+          cerr << mpi << "shm : processus sur plusieurs noeuds, ignore" << endl;
+        }
+      }
+      for (auto r : agents.ranks()) {
+        mpi.send_message(space.comm, r, MMT_BECOME,
+            string { agents.kind(r) });
       }
 
+      // broadcasts in flight, their buffers are kept until they complete
+      deque<diffusion> en_vol;
+      auto version_diffusee = sans_version;
+      auto diffuser_collectif = [&](bool fin) {
+        en_vol.emplace_back();
+        auto& d = en_vol.back();
+        wire_writer wr {d.charge};
+        wr.u8('B');
+        wr.u8(fin);
+        wr.u32(static_cast<uint32_t>(agents.size()));
+        for (auto r : agents.ranks()) {
+          wr.i32(r);
+          wr.position(agents.position(r));
+        }
+        corps_carte(wr, map, version_diffusee, partage.get());
+        version_diffusee = map.getVersion();
+        d.taille = static_cast<uint32_t>(d.charge.size());
+        MPI_Ibcast(&d.taille, 1, MPI_UINT32_T, 0, intra.comm, &d.requetes[0]);
+        MPI_Ibcast(&d.charge[0], d.taille, MPI_CHAR, 0, intra.comm, &d.requetes[1]);
+        // the endpoint polls them, which also drives their progress
+        d.en_cours = 2;
+        for (auto req : d.requetes) {
+          ep.watch(req, [&] {
+            --d.en_cours;
+            while (!en_vol.empty() && en_vol.front().en_cours == 0) {
+              en_vol.pop_front();
+            }
+          });
+        }
+      };
+
       // add an handler to receive the replies to the BECOME messages just sent,
       // messages don't get dropped so they'll wait, no worries
+      int prets { };
       ep.add_handler(MMT_BECOME, [&](const mpi_message& msg) {
         // child replied -> it is ready
-          stringstream mapss {};
-          mapss << map.getLookupTable().at(msg.source);
-          mapss << map;
-          cout << mpi << "Ding!:" << map.getLookupTable().at(msg.source) << " " << msg.comment << endl;
+          auto pos = agents.position(msg.source);
+          if (opts.bcast) {
+            cout << mpi << "Ding!:" << pos << " " << msg.comment << endl;
+            // everyone gets the whole map at once, in the first broadcast
+            if (++prets == nb_agents) {
+              diffuser_collectif(false);
+            }
+            return;
+          }
+          auto mapss = message_carte(map, pos, connues[msg.source],
+              partage.get());
+          connues[msg.source] = map.getVersion();
+          cout << mpi << "Ding!:" << pos << " " << msg.comment << endl;
           // send it some work
-          ep.reply(msg, MMT_DO, mapss.str());
+          ep.reply(msg, MMT_DO, move(mapss));
         });
 
+      // applies a move request and returns its outcome, ends the game once over
+      auto jouer = [&](const mpi_message& msg, int source,
+          const Position& posCour, const Position& posDest) {
+        auto r = arbitrer(map, m[source], posCour, posDest, dernier_map_stat);
+        if (r.disparu != sans_rang) {
+          EXTERMINER(ep, r.disparu, r.ou, msg);
+        }
+        if (r.fin) {
+          if (opts.bcast) {
+            cout << mpi << "SUICIDE_COLLECTIF" << endl;
+            diffuser_collectif(true);
+            ep.request_stop();
+          } else {
+            SUICIDE_COLLECTIF(mpi, space, ep, msg, agents);
+          }
+        }
+        return r;
+      };
+
+      // one message per recipient, serialized by the pool while the map
+      // stays untouched, then posted from this thread
+      vector<int> rangs;
+      vector<Position> positions;
+      vector<string> envois;
+      auto envoyer = [&](const mpi_message& msg, int tag,
+          const function<void(size_t, string&)>& construire) {
+        envois.resize(rangs.size());
+        for (auto& e : envois) {
+          e = ep.acquire_buffer();
+        }
+        pool.parallel_for(rangs.size(), [&](size_t i) {
+          construire(i, envois[i]);
+        });
+        for (size_t i = 0; i != rangs.size(); ++i) {
+          ep.reply(msg, rangs[i], tag, move(envois[i]));
+        }
+      };
+
+      // Broadcast des cases modifiees, encodees une fois par version connue
+      std::map<Map::version_type, size_t> groupes;
+      vector<Map::version_type> bases;
+      vector<string> corps;
+      vector<size_t> corps_de;
+      auto diffuser = [&](const mpi_message& msg) {
+        if (partage) {
+          partage->publish(map);
+        }
+        if (opts.bcast) {
+          diffuser_collectif(false);
+          return;
+        }
+        rangs.clear();
+        positions.clear();
+        corps_de.clear();
+        groupes.clear();
+        bases.clear();
+        for (auto r : agents.ranks()) {
+          auto& connue = connues[r];
+          auto g = groupes.emplace(connue, bases.size());
+          if (g.second) {
+            bases.push_back(connue);
+          }
+          rangs.push_back(r);
+          positions.push_back(agents.position(r));
+          corps_de.push_back(g.first->second);
+          connue = map.getVersion();
+        }
+        // an agent far behind gets the whole map, long to encode
+        corps.resize(bases.size());
+        pool.parallel_for(bases.size(), [&](size_t k) {
+          corps[k].clear();
+          wire_writer wr {corps[k]};
+          corps_carte(wr, map, bases[k], partage.get());
+        }, 2);
+        envoyer(msg, MMT_DO, [&](size_t i, string& e) {
+          e = encoder( {positions[i]}, move(e));
+          e.append(corps[corps_de[i]]);
+        });
+      };
+
+      // tick mode: the requests of a tick, at most one per agent
+      vector<demande> tour;
+      vector<int> place(agents.size(), -1);
+      vector<uint32_t> reclame(map.getCellCount());
+      uint32_t tick { };
+      mpi_message dernier { };
+
+      // applies every request of the tick in rank order, the first request
+      // claiming a cell wins it, then sends the result to everyone once
+      auto resoudre = [&]() {
+        ep.cancel_deadline();
+        sort(begin(tour), end(tour),
+            [](const demande& a, const demande& b) {return a.rank < b.rank;});
+        ++tick;
+        auto version = map.getVersion();
+        bool en_cours = true;
+        for (auto& d : tour) {
+          place[d.rank] = -1;
+          if (!en_cours) {
+            continue;
+          }
+          // eaten earlier in the tick, its request is void
+          if (map.getRankPosition(d.cour) != d.rank) {
+            continue;
+          }
+          // staying in place claims nothing, and only an accepted move claims
+          // its cell: a refused one (into a rat) must not keep a cat from
+          // eating there in the same tick
+          auto claim = d.dest != d.cour && map.contains(d.dest);
+          auto i = claim ? map.getIndex(d.dest) : 0;
+          if (claim && reclame[i] == tick) {
+            ++m[d.rank].nbDemandes;
+            continue;
+          }
+          auto r = jouer(dernier, d.rank, d.cour, d.dest);
+          if (claim && r.accepte) {
+            reclame[i] = tick;
+          }
+          en_cours = !r.fin;
+        }
+        tour.clear();
+        // a tick of refused moves leaves the map as it was: nothing to send
+        if (en_cours && map.getVersion() != version) {
+          diffuser(dernier);
+        }
+      };
+
       // add an handler to process their move requests
       ep.add_handler(MMT_DO,
           [&](const mpi_message& msg) {
-            Position posDest, posCour;
-            stringstream doss {};
-            doss << msg.comment;
-            doss >> posDest >> posCour;
-
-            auto rats_avant = map.getListeRat();
-            std::map<int, Position> lt_avant = {begin(map.getLookupTable()), end(map.getLookupTable())};
-            Position newPos = map.Move(posCour,posDest, statistique);
-            auto rats_apres = map.getListeRat();
-            ++m[msg.source].nbDemandes;
-            if (newPos==posDest) {
-              ++m[msg.source].nbMouvAcceptes;
-            }
-            auto maintenant = system_clock::now();
-            auto diff_temps = maintenant - dernier_map_stat;
-            auto diff_secondes = duration_cast<seconds>(diff_temps).count();
-            if (diff_secondes > 0) {
-              statistique << duration_cast<milliseconds>(diff_temps).count() << "ms depuis la derniere carte" << endl << map << endl;
-              dernier_map_stat = maintenant;
-            }
-
-            if (rats_apres.empty()) {
-              SUICIDE_COLLECTIF(mpi, space, ep, msg, lt_avant);
-              return;
+            if (!msg.latest) {
+              return; // the agent already sent a newer request
             }
+            wire_reader doss {msg.comment};
+            Position posDest = doss.position(), posCour = doss.position();
 
-            if (rats_avant.size() != rats_apres.size()) {
-              size_t i = 0;
-              for (; i != rats_apres.size(); ++i) {
-                if (rats_avant[i] != rats_apres[i]) {
-                  EXTERMINER(ep, lt_avant, rats_avant[i], msg);
-                  break;
-                }
+            if (opts.tick.count()) {
+              if (!agents.alive(msg.source)) {
+                return; // sent before it was exterminated
               }
-              if (i == rats_apres.size()) {
-                EXTERMINER(ep, lt_avant, rats_avant[i], msg);
+              if (tour.empty()) {
+                ep.set_deadline(mpi_endpoint::clock_type::now() + opts.tick, resoudre);
               }
+              auto& p = place[msg.source];
+              if (p < 0) {
+                p = static_cast<int>(tour.size());
+                tour.push_back(demande {msg.source, posCour, posDest});
+              } else {
+                tour[p] = demande {msg.source, posCour, posDest};
+              }
+              dernier = msg;
+              if (tour.size() == agents.size()) {
+                resoudre();
+              }
+              return;
             }
 
-            if (map.getListeFromage().empty()) {
-              SUICIDE_COLLECTIF(mpi, space, ep, msg, lt_avant);
+            // decided on an old map: its cell may hold someone else by now
+            if (!agents.alive(msg.source) || agents.position(msg.source) != posCour) {
               return;
-            } else {
-              if (newPos==posDest) {
-                //cout << mpi << newPos << msg.source << endl << map << endl;
-                // Broadcast de la map
-                for (auto r: map.getLookupTable()) {
-                  stringstream mapss {};
-                  mapss << map.getLookupTable().at(r.first);
-                  mapss << map;
-                  ep.reply(msg, r.first, MMT_DO, mapss.str());
-                }
+            }
+            auto r = jouer(msg, msg.source, posCour, posDest);
+            // a rat leaving by an exit is accepted too: it vanishes from the map
+            if (!r.fin && r.accepte) {
+              //cout << mpi << newPos << msg.source << endl << map << endl;
+              if (opts.bcast) {
+                // one broadcast for all the moves accepted until no request is waiting
+                ep.set_deadline(mpi_endpoint::clock_type::now(), [&] {
+                  diffuser(mpi_message {}); // no reply, msg is not needed
+                });
+              } else {
+                diffuser(msg);
               }
             }
           });
+      // an agent missed a version of the map, send it the whole map
+      ep.add_handler(MMT_SYNC, [&](const mpi_message& msg) {
+        if (!agents.alive(msg.source)) {
+          return;
+        }
+        if (partage) {
+          partage->publish(map);
+        }
+        auto mapss = message_carte(map, agents.position(msg.source),
+            sans_version, partage.get());
+        connues[msg.source] = map.getVersion();
+        ep.reply(msg, MMT_DO, move(mapss));
+      });
+      // only the rats within earshot are alerted, with the cat's position
+      vector<Position> a_portee;
       ep.add_handler(MMT_SPECIAL,
           [&](const mpi_message& msg) {
-            statistique << "Le processus " << msg.source << " a fait MIAOUX à " << msg.comment << endl;
-            for (auto r : map.getListeRat()) {
-              auto rank = map.getRankPosition(r);
-              stringstream sss {};
-              sss << msg.comment << r << map;
-              ep.reply(msg, rank, MMT_SPECIAL, sss.str());
+            wire_reader rd {msg.comment};
+            auto chat = rd.position();
+            journal->meow(msg.source, chat);
+            a_portee.clear();
+            map.getSpatialIndex(Map::CIBLE_RAT).within(chat, portee_miaou, a_portee);
+            for (auto& r : a_portee) {
+              ep.reply(msg, map.getRankPosition(r), MMT_SPECIAL,
+                  encoder( {chat}, ep.acquire_buffer()));
             }
           });
 
       // start handling received messages
       ep.start(space.comm);
+      ep.complete_watched();
       ep.prune(space.comm);
       cout << map << endl;
-
-      ofstream fichier("diagnostic.txt", ios::out | ios::trunc);
-
-      if (fichier) {
-        int numeroProcessus = 0;
-        for (auto it = m.get(); it != m.get() + qty_r + qty_c; ++it) {
-          double proportion = (double) it->nbMouvAcceptes / it->nbDemandes;
-          statistique << "Le processus " << numeroProcessus << " a fait "
-              << it->nbDemandes << " demandes de mouvements" << endl;
-          statistique << "----Sa proportion de mouvements acceptés est: "
-              << proportion << endl;
-          ++numeroProcessus;
-        }
-        auto diff_temps = system_clock::now() - debut_root;
-        auto diff_secondes = duration_cast<milliseconds>(diff_temps).count();
-        statistique << "Le temps total d'éxécution est " << diff_secondes
-            << "ms" << endl;
-        fichier << statistique.str() << std::flush;
-        fichier << map << endl;
-      } else {
-        cerr << "Erreur à l'ouverture !" << endl;
-      }
+      ecrire_diagnostic(m.get(), qty_r + qty_c, debut_root, map);
     }
   }
 }
@@ -3,48 +3,315 @@
  *
  *  Created on: 5 ao�t 2016
  *      Author: Phil
+ *
+ * Banc d'essai des recherches de chemin, sur chaque carte de cartes/ (ou
+ * celles donnees) et sur de grandes cartes generees :
+ *   - un seul but : rat vers fromage (A* 4, A* 8, JPS, HPA*), chat vers rat ;
+ *   - ensemble de buts : rat vers le fromage le plus proche, chat vers le rat
+ *     le plus proche, pas sur le champ de distances des fromages ;
+ *   - tour complet : chaque agent decide une fois, comme en partie locale.
+ * Chaque charge est d'abord jouee <echauffement> fois sans mesure, puis
+ * <repetitions> fois. Sortie : une ligne par carte et par charge, separee par
+ * des tabulations, avec la mediane et le 99e centile des durees d'appel, les
+ * cases developpees et les allocations par appel.
+ *
+ * Les cartes generees le sont par MapGenerator, en topologie ouverte sauf
+ * options topologie= (repetables).
+ *
+ * usage : main2 [repetitions=n] [echauffement=n] [paires=n] [taille=n]...
+ *     [topologie=ouverte|labyrinthe|salles]... [carte]...
  */
 
-
 #include "map.h"
+#include "mapgenerator.h"
+#include "pathfinder.h"
+#include <dirent.h>
+#include <algorithm>
 #include <chrono>
-#include <ctime>
-
-int main() {
-  using namespace std::chrono;
-
-  ifstream myfile("cartes/map3");
-  if (myfile.is_open()) {
-    return 1;
-  }
-  Map map = Map(myfile);
-  cout << map;
-
-  /*
-  unordered_map<Position, Position, PositionHasher> previous; // contains the previous positions
-  previous[Position{}] = Position{42, 24};
-  previous[Position{2,4}] = Position{242, 224};
-  previous[Position{2,4}] = Position{2421, 1224};
-  unordered_map<Position, int, PositionHasher> fCost; // distance from starting node + heuristic
-  auto comp =
-      [&] (const Position& f, const Position& s) {
-    return fCost[f] > fCost[s];};
-  std::priority_queue<Position, std::vector<Position>, decltype(comp)> priorityQueue(
-      comp); // lowest cost value always on top
-  fCost[Position{1337,23}] = 0;
-  fCost[Position{42, 24}] = 8;
-  priorityQueue.push(Position{1337,23}); // We add the first node in the queue
-  priorityQueue.push(Position{1337,223}); // We add the first node in the queue
-  Position currentPosition = priorityQueue.top(); // We pick the first element
-  priorityQueue.pop(); // We pop the first element
-  priorityQueue.push(Position{42, 24}); // We add the first node in the queue*/
-  auto avant = system_clock::now();
-  auto pos = map.AStarShortestPath(map.getMapElement({2,4}), map.getMapElement({24,20}));
-  auto apres = system_clock::now();
-  cout << "Le prochain movement de la source sera:" << endl;
-  cout << pos.getX() << " " << pos.getY() << endl;
-  cout << "Chemin evaluer en " << duration_cast<milliseconds>(apres-avant).count() <<  " ms." << endl;
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <random>
+
+using namespace std::chrono;
+
+namespace {
+
+// operator new compte les allocations, le banc est mono fil
+std::size_t allocations { };
+
+struct options {
+  int repetitions = 5;
+  int echauffement = 1;
+  std::size_t paires = 500; // requetes a un seul but par charge, au plus
+  std::vector<std::size_t> tailles;
+  std::vector<MapGenerator::Topologie> topologies;
+  std::vector<std::string> cartes;
+};
+
+options lire_options(int argc, char* argv[]) {
+  options o { };
+  for (int i = 1; i < argc; ++i) {
+    std::string arg { argv[i] };
+    if (arg.compare(0, 12, "repetitions=") == 0) {
+      o.repetitions = max(1, atoi(arg.c_str() + 12));
+    } else if (arg.compare(0, 13, "echauffement=") == 0) {
+      o.echauffement = max(0, atoi(arg.c_str() + 13));
+    } else if (arg.compare(0, 7, "paires=") == 0) {
+      o.paires = static_cast<std::size_t>(max(1, atoi(arg.c_str() + 7)));
+    } else if (arg.compare(0, 7, "taille=") == 0) {
+      o.tailles.push_back(
+          static_cast<std::size_t>(max(8, atoi(arg.c_str() + 7))));
+    } else if (arg == "topologie=labyrinthe") {
+      o.topologies.push_back(MapGenerator::LABYRINTHE);
+    } else if (arg == "topologie=salles") {
+      o.topologies.push_back(MapGenerator::SALLES);
+    } else if (arg == "topologie=ouverte") {
+      o.topologies.push_back(MapGenerator::OUVERTE);
+    } else {
+      o.cartes.push_back(arg);
+    }
+  }
+  if (o.tailles.empty()) {
+    o.tailles = { 256, 512 };
+  }
+  if (o.topologies.empty()) {
+    o.topologies = { MapGenerator::OUVERTE };
+  }
+  return o;
 }
 
+std::vector<std::string> cartes_du_depot() {
+  std::vector<std::string> cartes;
+  if (auto dir = opendir("cartes")) {
+    while (auto e = readdir(dir)) {
+      if (e->d_name[0] != '.') {
+        cartes.push_back(std::string { "cartes/" } + e->d_name);
+      }
+    }
+    closedir(dir);
+  }
+  sort(begin(cartes), end(cartes));
+  return cartes;
+}
+
+struct mesure {
+  std::vector<double> durees; // ns par appel
+  std::size_t developpes, allocations;
+};
+
+/*
+ Joue <n> appels <echauffement> fois sans mesure puis <repetitions> fois ;
+ appel(i) retourne le nombre de cases developpees.
+ */
+mesure mesurer(const options& o, std::size_t n,
+    const std::function<std::size_t(std::size_t)>& appel) {
+  mesure m { { }, 0, 0 };
+  for (int r = 0; r != o.echauffement; ++r) {
+    for (std::size_t i = 0; i != n; ++i) {
+      appel(i);
+    }
+  }
+  m.durees.reserve(n * o.repetitions);
+  auto allocations_avant = allocations;
+  for (int r = 0; r != o.repetitions; ++r) {
+    for (std::size_t i = 0; i != n; ++i) {
+      auto avant = steady_clock::now();
+      m.developpes += appel(i);
+      auto apres = steady_clock::now();
+      m.durees.push_back(duration<double, std::nano>(apres - avant).count());
+    }
+  }
+  // la reservation des durees est faite avant le compte
+  m.allocations = allocations - allocations_avant;
+  return m;
+}
+
+void rapporter(const std::string& carte, const char* charge, mesure& m) {
+  auto n = m.durees.size();
+  if (!n) {
+    return;
+  }
+  sort(begin(m.durees), end(m.durees));
+  auto centile = [&](std::size_t p) {
+    return m.durees[min(n - 1, n * p / 100)];
+  };
+  cout << carte << '\t' << charge << '\t' << n << '\t'
+      << static_cast<long long>(centile(50)) << '\t'
+      << static_cast<long long>(centile(99)) << '\t'
+      << double(m.developpes) / n << '\t' << double(m.allocations) / n << endl;
+}
 
+using paire = std::pair<Position, Position>;
 
+// au plus <n> paires source x but, tirees au hasard au-dela
+std::vector<paire> tirer(const std::vector<Position>& sources,
+    const std::vector<Position>& buts, std::size_t n, std::mt19937& alea) {
+  std::vector<paire> paires;
+  if (sources.empty() || buts.empty()) {
+    return paires;
+  }
+  if (sources.size() * buts.size() <= n) {
+    for (auto& s : sources) {
+      for (auto& b : buts) {
+        paires.emplace_back(s, b);
+      }
+    }
+  } else {
+    for (std::size_t i = 0; i != n; ++i) {
+      paires.emplace_back(sources[alea() % sources.size()],
+          buts[alea() % buts.size()]);
+    }
+  }
+  return paires;
+}
+
+void banc(const options& o, const std::string& nom, Map& map,
+    std::mt19937& alea) {
+  auto& pf = PathFinder::local();
+  auto rats = map.getListeRat();
+  auto fromages = map.getListeFromage();
+  std::vector<Position> chats;
+  auto& agents = map.getAgents();
+  for (auto r : agents.ranks()) {
+    if (agents.kind(r) == CHAT) {
+      chats.push_back(agents.position(r));
+    }
+  }
+
+  // un seul but
+  auto rat_fromage = tirer(rats, fromages, o.paires, alea);
+  auto chat_rat = tirer(chats, rats, o.paires, alea);
+  const struct {
+    const char* charge;
+    Map::Voisinage voisinage;
+  } voisinages[] { { "rat-fromage/a*4", Map::VOISINAGE_4 }, {
+      "rat-fromage/a*8", Map::VOISINAGE_8 }, { "rat-fromage/jps",
+      Map::VOISINAGE_8_JPS } };
+  for (auto& v : voisinages) {
+    map.setVoisinage(RAT, v.voisinage);
+    auto m = mesurer(o, rat_fromage.size(), [&](std::size_t i) {
+      map.AStarShortestPath(rat_fromage[i].first, rat_fromage[i].second);
+      return pf.getExpansions();
+    });
+    rapporter(nom, v.charge, m);
+  }
+  map.setVoisinage(RAT, Map::VOISINAGE_4);
+  map.EnableHierarchy(16);
+  auto m = mesurer(o, rat_fromage.size(), [&](std::size_t i) {
+    map.HierarchicalShortestPath(rat_fromage[i].first, rat_fromage[i].second);
+    return ClusterGraph::getExpansions();
+  });
+  rapporter(nom, "rat-fromage/hpa", m);
+  map.EnableHierarchy(0);
+  m = mesurer(o, chat_rat.size(), [&](std::size_t i) {
+    map.AStarShortestPath(chat_rat[i].first, chat_rat[i].second);
+    return pf.getExpansions();
+  });
+  rapporter(nom, "chat-rat/a*4", m);
+
+  // ensemble de buts
+  m = mesurer(o, rats.size(), [&](std::size_t i) {
+    map.AStarShortestPathForDestinationSet(rats[i], fromages);
+    return pf.getExpansions();
+  });
+  rapporter(nom, "rat-fromages/largeur", m);
+  m = mesurer(o, chats.size(), [&](std::size_t i) {
+    map.AStarShortestPathForDestinationSet(chats[i], rats);
+    return pf.getExpansions();
+  });
+  rapporter(nom, "chat-rats/largeur", m);
+  DistanceField champ;
+  m = mesurer(o, 1, [&](std::size_t) {
+    champ.Build(map, RAT, fromages);
+    return map.getCellCount();
+  });
+  rapporter(nom, "champ-fromages/construction", m);
+  map.getDistanceField(Map::CIBLE_FROMAGE);
+  m = mesurer(o, rats.size(), [&](std::size_t i) {
+    map.NextStepOnField(rats[i], Map::CIBLE_FROMAGE);
+    return std::size_t { };
+  });
+  rapporter(nom, "rat-fromages/champ", m);
+
+  // tour complet, sur une carte qui n'a pas change : les champs sont a jour
+  const Map& lue = map;
+  auto& index_rats = map.getSpatialIndex(Map::CIBLE_RAT);
+  m = mesurer(o, 1, [&](std::size_t) {
+    std::size_t developpes { };
+    for (auto r : agents.ranks()) {
+      auto& pos = agents.position(r);
+      if (agents.kind(r) == CHAT) {
+        lue.AStarShortestPathForDestinationSet(pos, rats);
+        developpes += pf.getExpansions();
+        Position proche;
+        index_rats.nearest(pos, proche);
+      } else {
+        lue.NextStepOnField(pos, Map::CIBLE_FROMAGE);
+      }
+    }
+    return developpes;
+  });
+  rapporter(nom, "tour", m);
+}
+
+}
+
+void* operator new(std::size_t n) {
+  ++allocations;
+  if (auto p = std::malloc(n ? n : 1)) {
+    return p;
+  }
+  throw std::bad_alloc { };
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+int main(int argc, char* argv[]) {
+  auto o = lire_options(argc, argv);
+  if (o.cartes.empty()) {
+    o.cartes = cartes_du_depot();
+  }
+  std::mt19937 alea { 2016 }; // memes paires d'une execution a l'autre
+
+  cout << "carte\tcharge\tappels\tp50_ns\tp99_ns\tdeveloppes\tallocations"
+      << endl;
+  for (auto& nom : o.cartes) {
+    Map map;
+    if (!map.Load(nom)) {
+      cerr << nom << " : carte pas ouvrable" << endl;
+      return 1;
+    }
+    banc(o, nom, map, alea);
+  }
+  // un rat par 200 cases, un chat par 1000 et un fromage par 150
+  const char* noms[] { "ouverte", "labyrinthe", "salles" };
+  for (auto taille : o.tailles) {
+    for (auto topologie : o.topologies) {
+      MapGenerator::Parametres p { };
+      p.largeur = p.hauteur = taille;
+      p.topologie = topologie;
+      p.rats = taille * taille / 200;
+      p.chats = taille * taille / 1000 + 1;
+      p.fromages = taille * taille / 150;
+      p.sorties = taille / 16;
+      p.graine = static_cast<std::uint32_t>(taille);
+      MapGenerator generateur { p };
+      if (!generateur.Generate()) {
+        cerr << taille << " : carte pas generable" << endl;
+        return 1;
+      }
+      auto texte = generateur.str();
+      Map map;
+      map.Parse(texte.data(), texte.size());
+      banc(o, std::string { noms[topologie] } + '-' + std::to_string(taille),
+          map, alea);
+    }
+  }
+}
@@ -1,137 +1,426 @@
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "event_log.h"
 #include "map.h"
+#include "pathfinder.h"
+#include "wire.h"
 
 using namespace std;
 
+namespace {
+
+const uint64_t octets_un = 0x0101010101010101, octets_haut = 0x8080808080808080;
+
+// bit haut de chaque octet nul de <v>, sans retenue d'un octet a l'autre
+uint64_t octets_nuls(uint64_t v) noexcept {
+  return ~(((v & ~octets_haut) + ~octets_haut) | v | ~octets_haut);
+}
+
+/*
+ Vrai si l'un des 8 octets de <mot> n'est pas un MUR, ni un VIDE hors du bord
+ (sur le bord, une case vide est une sortie).
+ */
+bool speciaux(uint64_t mot, bool bord) noexcept {
+  auto banals = octets_nuls(mot ^ (octets_un * static_cast<uint8_t>(MUR)));
+  if (!bord) {
+    banals |= octets_nuls(mot ^ (octets_un * static_cast<uint8_t>(VIDE)));
+  }
+  return (~banals & octets_haut) != 0;
+}
+
+}
+
+Map::Map()
+    : sizeX { }, sizeY { }, stride { }, version { }, agents { },
+        voisinages { { VOISINAGE_4, VOISINAGE_4 } } {
+  resize(0, 0);
+}
+
 Map::Map(istream& mapstream)
-    : sizeX { }, sizeY { }, lookupTable { } {
-  char c;
+    : sizeX { }, sizeY { }, stride { }, version { }, agents { },
+        voisinages { { VOISINAGE_4, VOISINAGE_4 } } {
+  string texte { istreambuf_iterator<char> { mapstream },
+      istreambuf_iterator<char> { } };
+  Parse(texte.data(), texte.size());
+}
+
+/**
+ * \fn bool Map::Load(const std::string& chemin)
+ *  \brief Remplace la carte par celle du fichier <chemin>, projete en memoire
+ *  le temps de l'analyser (voir Parse).
+ *
+ *  \return faux si le fichier ne peut etre ouvert ou projete ; la carte est
+ *  alors inchangee.
+ */
+bool Map::Load(const string& chemin) {
+  auto fd = open(chemin.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  auto n = static_cast<size_t>(st.st_size);
+  if (!n) {
+    close(fd);
+    Parse("", 0);
+    return true;
+  }
+  auto texte = mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // la projection reste valide
+  if (texte == MAP_FAILED) {
+    return false;
+  }
+  madvise(texte, n, MADV_SEQUENTIAL);
+  Parse(static_cast<const char*>(texte), n);
+  munmap(texte, n);
+  return true;
+}
+
+/**
+ * \fn void Map::Parse(const char* texte, std::size_t n)
+ *  \brief Remplace la carte par celle des <n> caracteres de <texte>, une
+ *  ligne par rangee.
+ *
+ *  Un premier parcours des fins de ligne (memchr) dimensionne la grille une
+ *  fois ; le second copie chaque rangee et n'examine case par case que les
+ *  mots de 8 cases contenant autre chose que des murs (et du vide, hors du
+ *  bord), pour remplir les listes et le registre des agents (rangs dans
+ *  l'ordre de lecture). Un '\r' en fin de ligne est ignore ; les rangees plus
+ *  courtes que la plus longue sont completees par HORS.
+ */
+void Map::Parse(const char* texte, size_t n) {
+  journal.clear();
+  for (auto& champ : champs) {
+    champ.invalidate();
+  }
+  auto fin = texte + n;
+  // prochaine rangee a partir de <p> : [p, p + longueur), suite apres
+  auto rangee = [fin](const char* p, size_t& longueur) {
+    auto nl = static_cast<const char*>(memchr(p, '\n', fin - p));
+    auto bout = nl ? nl : fin;
+    longueur = bout - p;
+    if (longueur && p[longueur - 1] == '\r') {
+      --longueur;
+    }
+    return nl ? nl + 1 : fin;
+  };
+  size_t largeur { }, hauteur { }, longueur;
+  auto p = texte;
+  do { // un texte vide est une rangee vide
+    p = rangee(p, longueur);
+    largeur = max(largeur, longueur);
+    ++hauteur;
+  } while (p != fin);
+  resize(largeur, hauteur);
+
   int rank = 0;
-  Position::coord_type x { }, y { }, m =
-      numeric_limits<Position::coord_type>::max();
-
-  while (mapstream.get(c)) {
-    Position pos(x % m, y);
-    ++x;
-    contenu[pos] = c;
-    switch (c) {
-    case '#':
-      break;
-    case 'F':
-      listeFromage.push_back(pos);
-      break;
-    case 'C':
-      lookupTable[rank++] = pos;
-      break;
-    case 'R':
-      lookupTable[rank++] = pos;
-      listeRat.push_back(pos);
-      break;
-    case ' ':
-      if (pos.getX() == 0 || pos.getX() == m - 2 || pos.getY() == 0) {
-        listeSortie.push_back(pos);
+  p = texte;
+  for (size_t y = 0; y != sizeY; ++y) {
+    auto debut = p;
+    p = rangee(p, longueur);
+    auto index = (y + 1) * stride + 1;
+    auto ligne = &contenu[index];
+    copy(debut, debut + longueur, ligne);
+    auto traiter = [&](size_t x, bool bord) {
+      auto c = ligne[x];
+      Position pos { static_cast<Position::coord_type>(x),
+          static_cast<Position::coord_type>(y) };
+      if (c == CHAT || c == RAT) {
+        agents.add(rank++, pos, index + x, c);
       }
-      break;
-    case '\r':
-      --x;
-      break;
-    case '\n':
-    default:
-      ++y;
-      m = x;
-      x = 0;
-      break;
+      noter(pos, index + x, c, bord);
+    };
+    // cases [x, jusque) par mots de 8, les mots banals sautes
+    auto balayer = [&](size_t x, size_t jusque, bool bord) {
+      for (; x + 8 <= jusque; x += 8) {
+        uint64_t mot;
+        memcpy(&mot, ligne + x, sizeof mot);
+        if (speciaux(mot, bord)) {
+          for (size_t k = 0; k != 8; ++k) {
+            traiter(x + k, bord);
+          }
+        }
+      }
+      for (; x < jusque; ++x) {
+        traiter(x, bord);
+      }
+    };
+    if (y == 0 || y + 1 == sizeY) {
+      balayer(0, longueur, true);
+      continue;
+    }
+    if (!longueur) {
+      continue;
+    }
+    traiter(0, true);
+    balayer(1, min(longueur, sizeX - 1), false);
+    if (longueur == sizeX && sizeX > 1) {
+      traiter(sizeX - 1, true);
     }
   }
-  sizeX = m - 1;
-  sizeY = y + 1;
+}
+
+/*
+ Format (voir wire.h) : 'M', version du format, dimensions, version de la
+ carte, table des agents (rang, index de case) puis les cases sur 3 bits, ligne par
+ ligne. Les listes de rats, fromages et sorties sont reconstruites pendant le
+ depaquetage des cases, qui les parcourt de toute facon.
+ */
+Map::Map(wire_reader& rd)
+    : sizeX { }, sizeY { }, stride { }, version { }, agents { },
+        voisinages { { VOISINAGE_4, VOISINAGE_4 } } {
+  Decode(rd);
+}
 
-  for (size_t xfin = 0; xfin < sizeX; ++xfin) {
-    auto pos = Position { static_cast<Position::coord_type>(xfin), y };
-    if (contenu[pos] == VIDE) {
-      listeSortie.push_back(pos);
+/**
+ * \fn void Map::Decode(wire_reader& rd)
+ *  \brief Remplace le contenu de la carte par celui ecrit par Encode.
+ *
+ *  La grille et les listes sont reutilisees : recharger une carte de memes
+ *  dimensions ne fait aucune allocation. Le journal est vide et les champs de
+ *  distances invalides.
+ *
+ *  \post Si le tampon est incoherent (dimension nulle, agents ou cases au-dela
+ *  de sa fin, case ou rang d'agent hors de la carte), rd est en echec.
+ */
+void Map::Decode(wire_reader& rd) {
+  journal.clear();
+  for (auto& champ : champs) {
+    champ.invalidate();
+  }
+  if (rd.u8() != 'M' || rd.u8() != wire_format) {
+    rd.fail();
+    resize(0, 0);
+    return;
+  }
+  auto x = rd.u32();
+  auto y = rd.u32();
+  version = rd.u64();
+  auto n = rd.u32();
+  // l'entete ne dimensionne la grille que si les agents (rang, case) et les
+  // cases tiennent dans le reste du tampon
+  const size_t taille_agent = 4 + 4;
+  auto cases = uint64_t { x } * y;
+  if (!rd.good() || !cases || n > rd.remaining() / taille_agent
+      || (cases * wire_cell_bits + 7) / 8
+          > rd.remaining() - n * taille_agent) {
+    rd.fail();
+    resize(0, 0);
+    return;
+  }
+  resize(x, y);
+  for (; n && rd.good(); --n) {
+    auto rank = rd.i32();
+    auto i = rd.u32();
+    // un agent par case au depart : son rang est aussi inferieur au nombre
+    // de cases
+    if (i >= cases || rank < 0 || static_cast<uint64_t>(rank) >= cases) {
+      rd.fail();
+      break;
     }
+    Position pos { static_cast<Position::coord_type>(i % x),
+        static_cast<Position::coord_type>(i / x) };
+    agents.add(rank, pos, getIndex(pos), HORS);
+  }
+  auto cells = rd.bytes((sizeX * sizeY * wire_cell_bits + 7) / 8);
+  if (!cells) {
+    return;
+  }
+  uint64_t acc { };
+  unsigned bits { };
+  for (size_t j = 0; j != sizeY; ++j) {
+    auto ligne = &contenu[(j + 1) * stride + 1];
+    auto bord = j == 0 || j + 1 == sizeY;
+    for (size_t i = 0; i != sizeX; ++i) {
+      if (bits < wire_cell_bits) {
+        acc |= static_cast<uint64_t>(static_cast<uint8_t>(*cells++)) << bits;
+        bits += 8;
+      }
+      auto c = wire_decode_cell(acc & ((1 << wire_cell_bits) - 1));
+      acc >>= wire_cell_bits;
+      bits -= wire_cell_bits;
+      ligne[i] = c;
+      Position pos { static_cast<Position::coord_type>(i),
+          static_cast<Position::coord_type>(j) };
+      noter(pos, (j + 1) * stride + i + 1, c,
+          bord || i == 0 || i + 1 == sizeX);
+    }
+  }
+  // le type d'un agent est celui de sa case
+  for (auto r : agents.ranks()) {
+    agents.setKind(r, contenu[agents.cell(r)]);
+  }
+}
+
+Map::Map(size_t x, size_t y, const char* cells)
+    : sizeX { }, sizeY { }, stride { }, version { }, agents { },
+        voisinages { { VOISINAGE_4, VOISINAGE_4 } } {
+  Assign(x, y, cells);
+}
+
+/**
+ * \fn void Map::Assign(std::size_t x, std::size_t y, const char* cells)
+ *  \brief Remplace la carte par x par y cases brutes, ligne par ligne.
+ *
+ *  Le registre des agents est vide : le rang des agents n'est connu que de
+ *  la racine.
+ */
+void Map::Assign(size_t x, size_t y, const char* cells) {
+  journal.clear();
+  for (auto& champ : champs) {
+    champ.invalidate();
   }
+  resize(x, y);
+  for (size_t j = 0; j != sizeY; ++j) {
+    copy(cells + j * sizeX, cells + (j + 1) * sizeX,
+        &contenu[(j + 1) * stride + 1]);
+  }
+  rebuildLists();
 }
 
 Map::~Map() {
 }
 
-void Map::updateListeRat(const Position& currentPos, const Position& nextPos) {
-  for (size_t i { }; i != listeRat.size(); ++i) {
-    if (listeRat[i] == currentPos) {
-      listeRat[i] = nextPos;
-      break;
+// remplit les listes de rats, fromages et sorties, videes par resize
+void Map::rebuildLists() {
+  for (size_t j = 0; j != sizeY; ++j) {
+    auto ligne = getRow(j);
+    auto bord = j == 0 || j + 1 == sizeY;
+    for (size_t i = 0; i != sizeX; ++i) {
+      Position pos { static_cast<Position::coord_type>(i),
+          static_cast<Position::coord_type>(j) };
+      noter(pos, getIndex(pos), ligne[i], bord || i == 0 || i + 1 == sizeX);
     }
   }
 }
 
-void Map::updateListeFromage(const Position& nextPos) {
-  for (unsigned int i = 0; i < listeFromage.size(); ++i) {
-    if (listeFromage[i] == nextPos) {
-      listeFromage.erase(listeFromage.begin() + i);
-      break;
-    }
+// range une case de la carte chargee dans les listes et les index
+void Map::noter(const Position& pos, index_type i, char c, bool bord) {
+  if (c == FROMAGE) {
+    listeFromage.insert(pos, i);
+    reperes[CIBLE_FROMAGE].insert(pos);
+  } else if (c == RAT) {
+    listeRat.insert(pos, i);
+    reperes[CIBLE_RAT].insert(pos);
+  } else if (c == VIDE && bord) {
+    listeSortie.push_back(pos);
+    sorties[i] = true;
+    reperes[CIBLE_SORTIE].insert(pos);
   }
 }
 
-void Map::updateLookupTable(const Position& currentPos,
-    const Position& nextPos) {
-  for (auto p : lookupTable) {
-    if (p.second == currentPos) {
-      lookupTable[p.first] = nextPos;
-      break;
-    }
+void Map::resize(size_t x, size_t y) {
+  sizeX = x;
+  sizeY = y;
+  stride = sizeX + 2;
+  contenu.assign(stride * (sizeY + 2), HORS);
+  agents.reset(contenu.size());
+  listeRat.reset(contenu.size());
+  listeFromage.reset(contenu.size());
+  listeSortie.clear();
+  sorties.assign(contenu.size(), false);
+  for (auto& index : reperes) {
+    index.reset(sizeX, sizeY);
+  }
+  for (auto& h : hierarchies) {
+    h.reset(*this);
   }
+  auto s = static_cast<offset_type>(stride);
+  voisins = { s, -s, 1, -1, s + 1, 1 - s, -s - 1, s - 1 };
 }
 
-void Map::updateListeRatMort(const Position& nextPos) {
-  for (unsigned int i = 0; i < listeRat.size(); ++i) {
-    if (listeRat[i] == nextPos) {
-      listeRat.erase(listeRat.begin() + i);
-      break;
+void Map::Encode(wire_writer& wr) const {
+  wr.reserve(
+      22 + 8 * agents.size() + (sizeX * sizeY * wire_cell_bits + 7) / 8);
+  wr.u8('M');
+  wr.u8(wire_format);
+  wr.u32(static_cast<uint32_t>(sizeX));
+  wr.u32(static_cast<uint32_t>(sizeY));
+  wr.u64(version);
+  wr.u32(static_cast<uint32_t>(agents.size()));
+  for (auto r : agents.ranks()) {
+    auto& pos = agents.position(r);
+    wr.i32(r);
+    wr.u32(static_cast<uint32_t>(pos.getY() * sizeX + pos.getX()));
+  }
+  uint64_t acc { };
+  unsigned bits { };
+  for (size_t j = 0; j != sizeY; ++j) {
+    auto ligne = &contenu[(j + 1) * stride + 1];
+    for (size_t i = 0; i != sizeX; ++i) {
+      acc |= static_cast<uint64_t>(wire_encode_cell(ligne[i])) << bits;
+      bits += wire_cell_bits;
+      if (bits >= 8) {
+        wr.u8(static_cast<uint8_t>(acc));
+        acc >>= 8;
+        bits -= 8;
+      }
     }
   }
+  if (bits) {
+    wr.u8(static_cast<uint8_t>(acc));
+  }
 }
 
+/**
+ * \fn Position Map::Move(const Position& currentPos, const Position& nextPos, event_log* journal, Disparu* disparu)
+ *  \brief Deplace l'element en currentPos vers nextPos si les regles le
+ *  permettent.
+ *
+ *  \post Retourne la nouvelle position de l'element. Si disparu est donne,
+ *  il recoit le rang et la derniere position du rat mange ou sorti par ce
+ *  mouvement.
+ */
 Position Map::Move(const Position& currentPos, const Position& nextPos,
-    stringstream& fichierStat) {
-  ifstream fic_out;
-  auto it = contenu.find(nextPos);
-  if (it == end(contenu)) {
+    event_log* journal, Disparu* disparu) {
+  if (disparu) {
+    disparu->rang = AgentRegistry::aucun;
+  }
+  if (!contains(nextPos) || !contains(currentPos)) {
     return currentPos;
   }
-  auto nextElem = it->second;
-  auto currentElem = contenu[currentPos]; // Tjrs valide
+  auto next = getIndex(nextPos), current = getIndex(currentPos);
+  auto nextElem = contenu[next];
+  auto currentElem = contenu[current];
 
-  // On a trouve quelque chose dans le unordered map
+  // On a trouve quelque chose dans la grille
   switch (nextElem) {
   case CHAT:
     return currentPos;
   case RAT:
     // CHAT MANGE RAT
     if (currentElem == CHAT) {
-      // updater la lookuptable
-      int chatRang, ratRang;
-      for (auto p : lookupTable) {
-        if (p.second == currentPos) {
-          chatRang = p.first;
-        } else if (p.second == nextPos) {
-          ratRang = p.first;
-        }
+      // updater le registre des agents
+      auto chatRang = agents.rankAt(current), ratRang = agents.rankAt(next);
+      agents.remove(ratRang);
+      if (chatRang != AgentRegistry::aucun) {
+        agents.move(chatRang, nextPos, next);
+      }
+      if (disparu) {
+        *disparu = Disparu { ratRang, nextPos };
       }
-      lookupTable[chatRang] = nextPos;
-      lookupTable.erase(ratRang);
+      champs[CIBLE_RAT].invalidate();
       // enlever le rat de la liste de rat
-      updateListeRatMort(nextPos);
+      listeRat.erase(next);
+      reperes[CIBLE_RAT].erase(nextPos);
       // updater les mapelements
-      contenu[nextPos] = currentElem;
-      contenu[currentPos] = VIDE;
-      fichierStat << "Chat " << chatRang << " a mangé le rat " << ratRang
-          << endl;
+      setCell(next, currentElem);
+      setCell(current, VIDE);
+      ++version;
+      if (journal) {
+        journal->cat_ate_rat(chatRang, ratRang, nextPos);
+      }
       return nextPos;
     } else { // RAT MANGE RAT
 
@@ -142,42 +431,62 @@ Position Map::Move(const Position& currentPos, const Position& nextPos,
     if (currentElem == CHAT) {
       return currentPos;
     } else { // RAT MANGE FROMAGE
-      updateLookupTable(currentPos, nextPos);
-      updateListeFromage(nextPos);
-      updateListeRat(currentPos, nextPos);
-      contenu[nextPos] = currentElem;
-      contenu[currentPos] = VIDE;
-      fichierStat << "Rat " << getRankPosition(nextPos)
-          << " a mange un fromage a la position " << nextPos << endl;
+      auto rang = agents.rankAt(current);
+      if (rang != AgentRegistry::aucun) {
+        agents.move(rang, nextPos, next);
+      }
+      listeFromage.erase(next);
+      reperes[CIBLE_FROMAGE].erase(nextPos);
+      listeRat.move(current, nextPos, next);
+      reperes[CIBLE_RAT].move(currentPos, nextPos);
+      // la case liberee change aussi le terrain des chats
+      champs[CIBLE_FROMAGE].invalidate();
+      champs[CIBLE_RAT].invalidate();
+      setCell(next, currentElem);
+      setCell(current, VIDE);
+      ++version;
+      if (journal) {
+        journal->rat_ate_cheese(rang, nextPos);
+      }
       return nextPos;
     }
   case MUR:
     return currentPos;
   case VIDE: {
-    if (inSequence(currentPos, listeSortie)) {
+    if (sorties[current]) {
       // CHAT SORT
       if (currentElem == CHAT) {
         return currentPos;
       } else { // RAT SORT
-        fichierStat << "Le rat " << getRankPosition(currentPos)
-            << " a quitté par la sortie " << nextPos << endl;
-        for (auto p : lookupTable) {
-          if (p.second == currentPos) {
-            lookupTable.erase(p.first);
-            break;
-          }
+        auto rang = agents.rankAt(current);
+        if (journal) {
+          journal->rat_exited(rang, nextPos);
         }
-        updateListeRatMort(currentPos);
-        contenu[currentPos] = VIDE;
+        agents.remove(rang);
+        if (disparu) {
+          *disparu = Disparu { rang, currentPos };
+        }
+        listeRat.erase(current);
+        reperes[CIBLE_RAT].erase(currentPos);
+        champs[CIBLE_RAT].invalidate();
+        setCell(current, VIDE);
+        ++version;
         return nextPos;
       }
     } else {
       // BOUGE CASE VIDE
-      updateLookupTable(currentPos, nextPos);
-      updateListeRat(currentPos, nextPos);
-      auto tmp = contenu[nextPos];
-      contenu[nextPos] = currentElem;
-      contenu[currentPos] = tmp;
+      auto rang = agents.rankAt(current);
+      if (rang != AgentRegistry::aucun) {
+        agents.move(rang, nextPos, next);
+      }
+      listeRat.move(current, nextPos, next);
+      if (currentElem == RAT) {
+        reperes[CIBLE_RAT].move(currentPos, nextPos);
+        champs[CIBLE_RAT].invalidate();
+      }
+      setCell(current, nextElem);
+      setCell(next, currentElem);
+      ++version;
       return nextPos;
     }
   }
@@ -186,26 +495,152 @@ Position Map::Move(const Position& currentPos, const Position& nextPos,
   }
 }
 
+void Map::setCell(index_type i, char c) {
+  for (auto& h : hierarchies) {
+    h.invalidate(getPosition(i), contenu[i], c);
+  }
+  contenu[i] = c;
+  if (journal.size() == taille_journal) {
+    journal.pop_front();
+  }
+  journal.push_back(Changement { version + 1, getPosition(i), c });
+}
+
+Map::version_type Map::getVersion() const noexcept {
+  return version;
+}
+
+void Map::setVersion(version_type v) noexcept {
+  version = v;
+}
+
+/**
+ * \fn bool Map::ChangesSince(version_type depuis, std::vector<Changement>& out)
+ *  \brief Ajoute a out les cases modifiees par Move apres la version depuis.
+ *
+ *  \post Retourne faux si le journal ne remonte plus jusqu'a depuis : il faut
+ *  alors envoyer la carte complete.
+ */
+bool Map::ChangesSince(version_type depuis, vector<Changement>& out) const {
+  if (depuis == version) {
+    return true;
+  }
+  if (depuis > version || journal.empty()
+      || journal.front().version > depuis + 1) {
+    return false;
+  }
+  auto it = lower_bound(begin(journal), end(journal), depuis + 1,
+      [](const Changement& c, version_type v) {return c.version < v;});
+  out.insert(end(out), it, end(journal));
+  return true;
+}
+
+/**
+ * \fn void Map::Apply(const Changement& c)
+ *  \brief Reporte sur une copie de la carte une case modifiee par Move.
+ *
+ *  Les listes de rats et de fromages suivent le changement, pas le
+ *  registre des agents : le rang des agents n'est connu que de la racine.
+ */
+void Map::Apply(const Changement& c) {
+  if (!contains(c.pos)) {
+    return;
+  }
+  auto i = getIndex(c.pos);
+  auto avant = contenu[i];
+  if (avant == c.cell) {
+    return;
+  }
+  if (avant == FROMAGE) {
+    listeFromage.erase(i);
+    reperes[CIBLE_FROMAGE].erase(c.pos);
+    champs[CIBLE_FROMAGE].invalidate();
+  } else if (avant == RAT) {
+    listeRat.erase(i);
+    reperes[CIBLE_RAT].erase(c.pos);
+  }
+  if (c.cell == RAT) {
+    listeRat.insert(c.pos, i);
+    reperes[CIBLE_RAT].insert(c.pos);
+  }
+  for (auto& h : hierarchies) {
+    h.invalidate(c.pos, avant, c.cell);
+  }
+  if (avant == RAT || c.cell == RAT || avant == FROMAGE) {
+    champs[CIBLE_RAT].invalidate();
+  }
+  contenu[i] = c.cell;
+  version = max(version, c.version);
+}
+
 std::ostream& Map::operator<<(std::ostream& os) const {
-  auto Y = static_cast<Position::coord_type>(sizeY);
-  for (Position::coord_type y = 0; y < Y; ++y) {
-    for (Position::coord_type x = 0;
-        x < static_cast<Position::coord_type>(sizeX); ++x) {
-      auto it = contenu.find(Position { x, y });
-      if (it == end(contenu)) {
-        os << "E";
+  // une seule ecriture par carte, depuis un tampon recycle
+  thread_local string tampon;
+  Render(tampon);
+  // do not put a newline at the end (this breaks (re)construction)
+  os.write(tampon.data(), static_cast<streamsize>(tampon.size()));
+  return os << flush;
+}
+
+void Map::Render(string& tampon) const {
+  tampon.resize(sizeY ? sizeY * (sizeX + 1) - 1 : 0);
+  auto out = &tampon[0];
+  for (size_t y = 0; y != sizeY; ++y) {
+    // les lignes sont contigues dans la grille
+    out = copy_n(&contenu[(y + 1) * stride + 1], sizeX, out);
+    if (y + 1 < sizeY) {
+      *out++ = '\n';
+    }
+  }
+}
+
+/*
+ Une suite de n >= 4 cases s'ecrit en au plus n caracteres : le rendu RLE
+ n'est jamais plus long que celui de Render, qui dimensionne le tampon.
+ */
+void Map::RenderRLE(string& tampon) const {
+  tampon.resize(sizeY ? sizeY * (sizeX + 1) - 1 : 0);
+  auto out = &tampon[0];
+  for (size_t y = 0; y != sizeY; ++y) {
+    auto ligne = &contenu[(y + 1) * stride + 1], fin = ligne + sizeX;
+    while (ligne != fin) {
+      auto c = *ligne;
+      auto suite = ligne + 1;
+      while (suite != fin && *suite == c) {
+        ++suite;
+      }
+      auto n = static_cast<size_t>(suite - ligne);
+      if (n < 4) {
+        out = fill_n(out, n, c);
       } else {
-        os << it->second;
+        char chiffres[20];
+        auto p = end(chiffres);
+        for (; n; n /= 10) {
+          *--p = static_cast<char>('0' + n % 10);
+        }
+        out = copy(p, end(chiffres), out);
+        *out++ = c;
       }
+      ligne = suite;
+    }
+    if (y + 1 < sizeY) {
+      *out++ = '\n';
     }
-    // do not put a newline at the end (this breaks (re)construction)
-    if (y < Y - 1) {
-      os << '\n'; //endl;
+  }
+  tampon.resize(static_cast<size_t>(out - tampon.data()));
+}
+
+void Map::ExpandRLE(const char* texte, size_t n, string& out) {
+  size_t compte { };
+  for (auto fin = texte + n; texte != fin; ++texte) {
+    auto c = *texte;
+    if (c >= '0' && c <= '9') {
+      compte = compte * 10 + static_cast<size_t>(c - '0');
     } else {
-      os << flush;
+      out.append(compte ? compte : 1, c);
+      compte = 0;
     }
   }
-  return os;
 }
 
 std::ostream& operator<<(std::ostream& os, const Map& that) {
@@ -214,132 +649,160 @@ std::ostream& operator<<(std::ostream& os, const Map& that) {
 }
 
 const std::vector<Position>& Map::getListeRat() const {
-  return listeRat;
+  return listeRat.elements();
 }
 
 const std::vector<Position>& Map::getListeFromage() const {
-  return listeFromage;
+  return listeFromage.elements();
 }
 
 const std::vector<Position>& Map::getListeSortie() const {
   return listeSortie;
 }
 
-const std::map<int, Position>& Map::getLookupTable() const {
-  return lookupTable;
+const AgentRegistry& Map::getAgents() const noexcept {
+  return agents;
 }
 
 char Map::showPosition(const Position& pos) const {
-  return contenu.find(pos)->second;
+  return contains(pos) ? contenu[getIndex(pos)] : HORS;
+}
+
+const SpatialIndex& Map::getSpatialIndex(Cible cible) const noexcept {
+  return reperes[cible];
+}
+
+bool Map::isExit(const Position& pos) const noexcept {
+  return contains(pos) && sorties[getIndex(pos)];
 }
 
 int Map::getRankPosition(const Position& pos) const {
-  for (auto p : getLookupTable()) {
-    if (p.second == pos) {
-      return p.first;
-    }
-  }
-  return numeric_limits<int>::max(); // pouf
+  return contains(pos) ? agents.rankAt(getIndex(pos)) : AgentRegistry::aucun;
+}
+
+std::size_t Map::getSizeX() const noexcept {
+  return sizeX;
+}
+
+std::size_t Map::getSizeY() const noexcept {
+  return sizeY;
+}
+
+// nombre de cases de la grille, bordure sentinelle comprise
+std::size_t Map::getCellCount() const noexcept {
+  return contenu.size();
 }
 
-template<class T, class S>
-bool inSequence(const T& e, const S& s) {
-  auto it = find(begin(s), end(s), e);
-  return it != end(s);
+bool Map::contains(const Position& pos) const noexcept {
+  return pos.getX() >= 0 && pos.getY() >= 0
+      && static_cast<size_t>(pos.getX()) < sizeX
+      && static_cast<size_t>(pos.getY()) < sizeY;
+}
+
+// valide pour toute position de la carte ou de sa bordure sentinelle
+Map::index_type Map::getIndex(const Position& pos) const noexcept {
+  return (pos.getY() + 1) * stride + (pos.getX() + 1);
+}
+
+Position Map::getPosition(index_type i) const noexcept {
+  return Position { static_cast<Position::coord_type>(i % stride) - 1,
+      static_cast<Position::coord_type>(i / stride) - 1 };
+}
+
+char Map::showIndex(index_type i) const noexcept {
+  return contenu[i];
+}
+
+const char* Map::getRow(size_t y) const noexcept {
+  return &contenu[(y + 1) * stride + 1];
+}
+
+const std::array<Map::offset_type, 8>& Map::getNeighbourOffsets() const
+    noexcept {
+  return voisins;
 }
 
 /**
  * \fn Map::AStarShortestPath(MapElement* source,MapElement* dest)
  *  \brief Retourne la premiere position du chemin le plus court,selon l'algorithme A*, vers une destination
  *
+ *  La recherche suit le voisinage choisi pour le type de l'element en
+ *  source (voir setVoisinage) : A* en 4 ou en 8-connexite, ou JPS.
+ *
  *  \pre le carte est valide.
  *  \pre le point d'origine existe.
  *  \pre le point d'arrivee existe.
  *
- *  \post Retourne la premi�re position du chemin le plus cours vers une destination
+ *  \post Retourne la premi�re position du chemin le plus cours vers une destination,
+ *  ou la source si la destination est inatteignable
  */
 Position Map::AStarShortestPath(const Position& sourcePosition,
-    const Position& destPosition) {
-  //Init
-  unordered_map<Position, int, PositionHasher> fCost; // distance from starting node + heuristic
-  unordered_map<Position, int, PositionHasher> gCost; // distance from starting node
-  unordered_map<Position, Position, PositionHasher> previous; // contains the previous positions
-  unordered_set<Position, PositionHasher> closedSet; // The set of nodes already evaluated
-  auto comp =
-      [&] (const Position& f, const Position& s) {return fCost[f] > fCost[s];};
-  std::priority_queue<Position, std::vector<Position>, decltype(comp)> priorityQueue(
-      comp); // lowest cost value always on top
-  int hCost = 0; // heuristic distance
-  int totalCost = 0;
-
-  //Init the first node
-  fCost[Position { -1, -1 }] = numeric_limits<int>::max(); // Quick fix set to max int
-  fCost[sourcePosition] = 0; // source cost is zero
-  gCost[sourcePosition] = 0; // source cost is zero
-  previous[sourcePosition] = sourcePosition; // previous position for the source is itself
-  priorityQueue.push(Position { -1, -1 }); // Quick fix because broken queue
-  priorityQueue.push(sourcePosition); // We add the first node in the queue
-  while (!priorityQueue.empty()) {
-    Position currentPosition = priorityQueue.top(); // We pick the first element
-    priorityQueue.pop(); // We pop the first element
-    closedSet.insert(currentPosition); // We add the node in the set
-
-    if (currentPosition == destPosition) {
-      break; //Destination reached we break out of the loop
-    }
-    std::vector<Position> nearbyPositions = FindNearbyPositions(currentPosition,
-        contenu[sourcePosition]); // We retreive all the nearby Positions
-    //We iterate through all the nearby positions
+    const Position& destPosition) const {
+  auto& pf = PathFinder::local();
+  switch (getVoisinage(showPosition(sourcePosition))) {
+  case VOISINAGE_8:
+    return pf.FirstStep8(*this, sourcePosition, destPosition);
+  case VOISINAGE_8_JPS:
+    return pf.FirstStepJPS(*this, sourcePosition, destPosition);
+  default:
+    return pf.FirstStep(*this, sourcePosition, destPosition);
+  }
+}
 
-    for (std::vector<Position>::iterator it = nearbyPositions.begin();
-        it != nearbyPositions.end(); ++it) {
-      Position currentNearbyPosition = (*it);
+// les regles de deplacement du chat valent pour tout ce qui n'est pas un rat
+static size_t parType(char type) {
+  return type == RAT ? 0 : 1;
+}
 
-      if (closedSet.find(currentNearbyPosition) != end(closedSet)) {
-        continue; // Ignore the neighbor which is already evaluated.
-      }
+void Map::setVoisinage(char type, Voisinage v) noexcept {
+  voisinages[parType(type)] = v;
+}
 
-      //Create new map entry if position wasn't already there
-      if (fCost.find(currentNearbyPosition) == end(fCost)) {
-        //We add a large number to the node, if it doesn't exist
-        fCost[currentNearbyPosition] = numeric_limits<int>::max(); //Infinity, Large number
-      }
+Map::Voisinage Map::getVoisinage(char type) const noexcept {
+  return voisinages[parType(type)];
+}
 
-      //Create new map entry if position wasn't already there
-      if (gCost.find(currentNearbyPosition) == end(gCost)) {
-        //We add the cost from the currentNearbyPosition to the source
-        gCost[currentNearbyPosition] = gCost.find(currentPosition)->second + 1;
-      } else { //already exist
-        if (gCost[currentNearbyPosition] > gCost[currentPosition] + 1) {
-          gCost[currentNearbyPosition] = gCost[currentPosition] + 1;
-        }
-      }
+/**
+ * \fn void Map::EnableHierarchy(std::size_t cote)
+ *  \brief Construit (ou desactive, si cote est nul) la couche hierarchique.
+ *
+ *  Les entrees des clusters et les distances entre elles sont calculees ici
+ *  une fois ; ensuite, Move ne marque que les clusters dont le terrain a
+ *  change, recalcules a la recherche suivante.
+ */
+void Map::EnableHierarchy(size_t cote) {
+  hierarchies[0].Build(*this, RAT, cote);
+  hierarchies[1].Build(*this, CHAT, cote);
+}
 
-      hCost = ManhattanDistance(currentNearbyPosition, destPosition); // distance betweeen currentNearbyPosition and destination
-      totalCost = hCost + gCost[currentNearbyPosition];
-      if (totalCost < fCost[currentNearbyPosition]) {
-        fCost[currentNearbyPosition] = totalCost;
-        previous[currentNearbyPosition] = currentPosition;
-        priorityQueue.push(currentNearbyPosition);
-      } // END IF
+bool Map::hasHierarchy() const noexcept {
+  return hierarchies[0].isEnabled();
+}
 
-    } // END FOR
-  } //END WHILE
+void Map::RepairHierarchy() {
+  for (auto& h : hierarchies) {
+    h.Repair(*this);
+  }
+}
 
-  //Reserve path
-  Position current = destPosition;
-  int nbStep = 0;
+Position Map::HierarchicalShortestPath(const Position& sourcePosition,
+    const Position& destPosition) {
+  hierarchies[parType(showPosition(sourcePosition))].Repair(*this);
+  return static_cast<const Map&>(*this).HierarchicalShortestPath(
+      sourcePosition, destPosition);
+}
 
-  while (previous[current] != sourcePosition) {
-    nbStep++;
-    current = previous[current];
+Position Map::HierarchicalShortestPath(const Position& sourcePosition,
+    const Position& destPosition) const {
+  auto& h = hierarchies[parType(showPosition(sourcePosition))];
+  if (!h.isEnabled()) {
+    return AStarShortestPath(sourcePosition, destPosition);
   }
-
-  return current;
+  return h.FirstStep(*this, sourcePosition, destPosition);
 }
 
 Position Map::GetClosestsDestination(const Position& sourcePosition,
-    const std::vector<Position>& destSet) {
+    const std::vector<Position>& destSet) const {
   int minDist = numeric_limits<int>::max(); // High cost to compare
   auto closestPos = destSet[0]; // we pick the first one
 
@@ -355,18 +818,71 @@ Position Map::GetClosestsDestination(const Position& sourcePosition,
 
 /**
  * \fn Map::AStarShortestPathForDestinationSet(MapElement* source,std::vector<MapElement*> destSet)
- *  \brief Retourne la premiere position du chemin le plus court, selon l'algorithme A* et l'heuristic de la distance Manhattan, vers le fromage ou le rat le plus proche de la source.
+ *  \brief Retourne la premiere position du chemin le plus court vers le fromage ou le rat atteignable le plus proche de la source.
+ *
+ *  Un seul parcours en largeur depuis la source, arrete a la premiere
+ *  destination rencontree : les murs sont pris en compte dans le choix de la
+ *  destination, contrairement a GetClosestsDestination.
  *
  *  \pre le carte est valide.
  *  \pre le point d'origine existe.
- *  \pre le point d'arrivee existe.
  *
- *  \post Retourne la premi�re position du chemin le plus cours vers la destination la plus proche
+ *  \post Retourne la premi�re position du chemin le plus cours vers la destination la plus proche,
+ *  ou la source si aucune destination n'est atteignable
  */
 Position Map::AStarShortestPathForDestinationSet(const Position& sourcePosition,
-    const std::vector<Position>& destSet) {
-  auto closest = GetClosestsDestination(sourcePosition, destSet);
-  return AStarShortestPath(sourcePosition, closest);
+    const std::vector<Position>& destSet) const {
+  return PathFinder::local().FirstStepToNearest(*this, sourcePosition, destSet);
+}
+
+/**
+ * \fn const DistanceField& Map::getDistanceField(Cible cible)
+ *  \brief Retourne le champ de distances vers les fromages, les sorties ou les rats.
+ *
+ *  Le champ n'est recalcule (un parcours en largeur sur la carte) que s'il a
+ *  ete invalide par Move : les sorties ne changent jamais, les fromages
+ *  seulement quand un rat en mange un, les rats a chacun de leurs mouvements.
+ *
+ *  \post Retourne un champ a jour
+ */
+const DistanceField& Map::getDistanceField(Cible cible) {
+  auto& champ = champs[cible];
+  if (!champ.isValid()) {
+    switch (cible) {
+    case CIBLE_FROMAGE:
+      champ.Build(*this, RAT, listeFromage.elements());
+      break;
+    case CIBLE_SORTIE:
+      champ.Build(*this, RAT, listeSortie);
+      break;
+    default:
+      champ.Build(*this, CHAT, listeRat.elements());
+      break;
+    }
+  }
+  return champ;
+}
+
+/**
+ * \fn Position Map::NextStepOnField(const Position& pos, Cible cible)
+ *  \brief Retourne le prochain pas vers la cible la plus proche en lisant le champ de distances.
+ *
+ *  \post Retourne une case voisine libre plus proche de la cible, ou pos
+ */
+Position Map::NextStepOnField(const Position& pos, Cible cible) {
+  return getDistanceField(cible).NextStep(*this, pos);
+}
+
+/**
+ * \fn Position Map::NextStepOnField(const Position& pos, Cible cible) const
+ *  \brief Comme NextStepOnField, sans recalculer le champ.
+ *
+ *  \pre getDistanceField(cible) a ete appelee depuis la derniere modification
+ *
+ *  \post Retourne une case voisine libre plus proche de la cible, ou pos
+ */
+Position Map::NextStepOnField(const Position& pos, Cible cible) const {
+  return champs[cible].NextStep(*this, pos);
 }
 
 /**
@@ -386,48 +902,29 @@ int Map::ManhattanDistance(Position source, Position dest) {
 }
 
 /**
- * \fn std::vector<Position> Map::FindNearbyPositions(MapElement* me)
- *  \brief Retourne un vector de position avoisinante pour un MapElement donn�
+ * \fn bool Map::isWalkable(char type, char cell)
+ *  \brief Indique si un element de type donne peut entrer dans une case
  *
- *  \pre le carte existe
- *  \pre l'�l�menet re�u existe.
- *
- *  \post Retourne un vecteur de position avoisinante
+ *  Le rat peut aller sur une case vide, une sortie ou un fromage, le chat sur
+ *  une case vide ou un rat. Les cases HORS de la bordure sentinelle ne sont
+ *  jamais accessibles.
  */
-std::vector<Position> Map::FindNearbyPositions(Position pos, char type) {
-
-  std::vector<Position> nearbyPositions;
-  if (type == 0) { // Rat
-    //Diagonal
-    nearbyPositions.push_back(Position { pos.getX() + 1, pos.getY() + 1 }); // NE
-    nearbyPositions.push_back(Position { pos.getX() + 1, pos.getY() - 1 }); // SE
-    nearbyPositions.push_back(Position { pos.getX() - 1, pos.getY() - 1 }); // SW
-    nearbyPositions.push_back(Position { pos.getX() - 1, pos.getY() + 1 }); // NW
-  }
-//Vertical
-  nearbyPositions.push_back(Position { pos.getX(), pos.getY() + 1 }); // N
-  nearbyPositions.push_back(Position { pos.getX(), pos.getY() - 1 }); // S
-
-//Horizontal
-  nearbyPositions.push_back(Position { pos.getX() + 1, pos.getY() }); // E
-  nearbyPositions.push_back(Position { pos.getX() - 1, pos.getY() }); // W
-
-//Trim out-of-the-map positions, Trim walls positions and we trim special positions depending if the source MapElement is a Cat or a Rat
-  nearbyPositions.erase(
-      std::remove_if(nearbyPositions.begin(), nearbyPositions.end(),
-          [&] (const Position& f) {
-            auto valide = contenu.find(Position {f.getX(), f.getY()});
-            if(valide == end(contenu)) {
-              return true;
-            }
-            else if(type == RAT) { // nearby position for the Rat so we keep only empty, exits and cheese
-              return !(contenu[f] == VIDE || contenu[f] == FROMAGE || contenu[f] == SORTIE );// If empty, exits or cheese we keep it (for the rat)
-            }
-            else { // nearby position for the Cat so we keep only empty and Rat
-              return !(contenu[f] == VIDE || contenu[f] == RAT );// If empty or rat we keep it (for the cat)
-            }
-          }), nearbyPositions.end());
-
-  return nearbyPositions;
+bool Map::isWalkable(char type, char cell) noexcept {
+  if (type == RAT) {
+    return cell == VIDE || cell == FROMAGE || cell == SORTIE;
+  } else {
+    return cell == VIDE || cell == RAT;
+  }
 }
 
+/**
+ * \fn bool Map::isTraversable(char type, char cell)
+ *  \brief Comme isWalkable, pour le terrain seul
+ *
+ *  Une case occupee par un agent (rat ou chat) est traversable : l'agent
+ *  n'y est que pour le moment. Les champs de distances et la couche
+ *  hierarchique sont calcules sur ce terrain.
+ */
+bool Map::isTraversable(char type, char cell) noexcept {
+  return cell == RAT || cell == CHAT || isWalkable(type, cell);
+}
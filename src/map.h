@@ -1,15 +1,23 @@
 #ifndef MAP_H_
 #define MAP_H_
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <fstream>
 #include <sstream>
-#include <map>
 #include <queue>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "agentregistry.h"
+#include "clustergraph.h"
+#include "distancefield.h"
 #include "position.h"
+#include "positionset.h"
+#include "spatialindex.h"
 
 #define FROMAGE 'F'
 #define CHAT 'C'
@@ -17,6 +25,7 @@
 #define RAT 'R'
 #define VIDE ' '
 #define SORTIE ' '
+#define HORS 'E'
 
 struct PositionHasher {
   std::size_t operator()(const Position& pos) const {
@@ -26,43 +35,173 @@ struct PositionHasher {
   }
 };
 
-template<class T, class S>
-bool inSequence(const T& e, const S& v);
+class event_log;
+class wire_reader;
+class wire_writer;
 
+/*
+ Carte du jeu.
+
+ Les cases sont stockees dans une grille contigue (ligne par ligne) entouree
+ d'une bordure sentinelle de cases HORS : les voisins d'une case valide sont
+ donc toujours adressables par simple arithmetique d'index, sans test de
+ bornes.
+ */
 class Map {
 public:
+  using index_type = std::size_t;
+  using offset_type = std::ptrdiff_t;
+  // ensembles de cibles pour lesquels un champ de distances est tenu a jour
+  enum Cible {
+    CIBLE_FROMAGE, CIBLE_SORTIE, CIBLE_RAT, NB_CIBLES
+  };
+  // recherche faite par AStarShortestPath, choisie par type d'element
+  enum Voisinage {
+    VOISINAGE_4, VOISINAGE_8, VOISINAGE_8_JPS
+  };
+  using version_type = std::uint64_t;
+  // case modifiee par Move, marquee de la version de la carte qui en resulte
+  struct Changement {
+    version_type version;
+    Position pos;
+    char cell;
+  };
+  static const std::size_t taille_journal = 4096;
+  // rat retire de la carte par un Move, mange ou sorti
+  struct Disparu {
+    int rang; // AgentRegistry::aucun si aucun rat n'a disparu
+    Position ou; // sa derniere position
+  };
+  // carte vide, a remplir par Load, Parse, Decode ou Assign
+  Map();
   Map(std::istream&);
+  // decode une carte ecrite par Encode, directement depuis le tampon recu
+  Map(wire_reader&);
+  // carte de x par y cases lues ligne par ligne depuis cells
+  Map(std::size_t x, std::size_t y, const char* cells);
   ~Map();
-  Position Move(const Position&, const Position&, stringstream&);
-  Position AStarShortestPath(const Position&, const Position&);
+  // les rats manges ou sortis et les fromages manges vont dans <journal>
+  Position Move(const Position&, const Position&, event_log* journal = nullptr,
+      Disparu* = nullptr);
+  Position AStarShortestPath(const Position&, const Position&) const;
+  /*
+   Par defaut les rats et les chats se deplacent en 4-connexite ; en
+   8-connexite, Move accepte deja les pas en diagonale.
+   */
+  void setVoisinage(char type, Voisinage) noexcept;
+  Voisinage getVoisinage(char type) const noexcept;
+  /*
+   Couche hierarchique (voir ClusterGraph) en clusters de <cote> cases, pour
+   les rats et pour les chats ; un cote nul la desactive.
+   */
+  void EnableHierarchy(std::size_t cote);
+  bool hasHierarchy() const noexcept;
+  /*
+   Repare les clusters modifies par Move ou Apply : la version const de
+   HierarchicalShortestPath peut ensuite etre appelee de plusieurs fils
+   d'execution a la fois.
+   */
+  void RepairHierarchy();
+  /*
+   Comme AStarShortestPath, par la couche hierarchique si elle est active,
+   apres avoir repare les clusters modifies par Move.
+   */
+  Position HierarchicalShortestPath(const Position&, const Position&);
+  // sans reparation : a appeler apres la version non const
+  Position HierarchicalShortestPath(const Position&, const Position&) const;
   Position GetClosestsDestination(const Position&,
-      const std::vector<Position>&);
+      const std::vector<Position>&) const;
   Position AStarShortestPathForDestinationSet(const Position&,
-      const std::vector<Position>&);
+      const std::vector<Position>&) const;
   std::ostream& operator<<(std::ostream& os) const;
+  /*
+   Texte de la carte (format de cartes/, sans fin de ligne finale) dans
+   <tampon>, remplace : une copie par rangee depuis la grille. Le tampon
+   garde sa capacite d'un rendu a l'autre.
+   */
+  void Render(std::string& tampon) const;
+  /*
+   Comme Render, chaque suite d'au moins 4 cases identiques d'une rangee
+   etant ecrite <nombre><case> (une case n'est jamais un chiffre).
+   */
+  void RenderRLE(std::string& tampon) const;
+  // texte de Render a partir de celui de RenderRLE, a la suite de <out>
+  static void ExpandRLE(const char* texte, std::size_t n, std::string& out);
+  void Encode(wire_writer&) const;
+  void Decode(wire_reader&);
+  void Assign(std::size_t x, std::size_t y, const char* cells);
+  // carte au format texte (cartes/)
+  bool Load(const std::string& chemin);
+  void Parse(const char* texte, std::size_t n);
   const std::vector<Position>& getListeRat() const;
   const std::vector<Position>& getListeFromage() const;
   const std::vector<Position>& getListeSortie() const;
-  const std::map<int, Position>& getLookupTable() const;
+  // rang et position des agents, connus de la racine seulement
+  const AgentRegistry& getAgents() const noexcept;
+  // rats, fromages ou sorties, pour les recherches de voisinage
+  const SpatialIndex& getSpatialIndex(Cible) const noexcept;
+
+  /*
+   Chaque Move qui modifie la carte incremente la version et consigne les
+   cases modifiees dans un journal borne, pour que les copies distantes de
+   la carte puissent etre mises a jour sans la retransmettre.
+   */
+  version_type getVersion() const noexcept;
+  void setVersion(version_type) noexcept;
+  bool ChangesSince(version_type, std::vector<Changement>&) const;
+  void Apply(const Changement&);
 
   char showPosition(const Position&) const;
+  bool isExit(const Position&) const noexcept;
   int getRankPosition(const Position&) const;
   static int ManhattanDistance(Position, Position);
+  static bool isWalkable(char type, char cell) noexcept;
+  static bool isTraversable(char type, char cell) noexcept;
+
+  /*
+   Champ de distances vers <cible>, recalcule seulement si Move a modifie
+   les cibles ou le terrain depuis le dernier appel.
+   */
+  const DistanceField& getDistanceField(Cible);
+  Position NextStepOnField(const Position&, Cible);
+  /*
+   Lit le champ tel quel, sans le recalculer : une fois les champs utiles
+   mis a jour par getDistanceField, la carte peut etre lue par plusieurs fils
+   d'execution a la fois.
+   */
+  Position NextStepOnField(const Position&, Cible) const;
+
+  std::size_t getSizeX() const noexcept;
+  std::size_t getSizeY() const noexcept;
+  std::size_t getCellCount() const noexcept;
+  bool contains(const Position&) const noexcept;
+  index_type getIndex(const Position&) const noexcept;
+  Position getPosition(index_type) const noexcept;
+  char showIndex(index_type) const noexcept;
+  // les sizeX cases de la ligne y, contigues
+  const char* getRow(std::size_t y) const noexcept;
+  // N, S, E, W, NE, SE, SW, NW
+  const std::array<offset_type, 8>& getNeighbourOffsets() const noexcept;
 private:
-  std::vector<Position> FindNearbyPositions(Position, char);
-  void updateListeRat(const Position& currentPos, const Position& nextPos);
-  void updateListeFromage(const Position& nextPos);
-  void updateLookupTable(const Position& currentPos, const Position& nextPos);
-  void updateListeRatMort(const Position& nextPos);
-  void updateLookupTableNext(const Position& currentPos,
-      const Position& nextPos);
+  void setCell(index_type, char);
+  void resize(std::size_t x, std::size_t y);
+  void rebuildLists();
+  void noter(const Position&, index_type, char, bool bord);
 
-  std::size_t sizeX, sizeY;
-  std::map<int, Position> lookupTable;
-  std::vector<Position> listeRat;
-  std::vector<Position> listeFromage;
+  std::size_t sizeX, sizeY, stride;
+  version_type version;
+  std::deque<Changement> journal;
+  AgentRegistry agents;
+  PositionSet listeRat;
+  PositionSet listeFromage;
   std::vector<Position> listeSortie;
-  unordered_map<Position, char, PositionHasher> contenu;
+  std::vector<bool> sorties; // par case de la grille
+  std::array<offset_type, 8> voisins;
+  std::vector<char> contenu;
+  std::array<DistanceField, NB_CIBLES> champs;
+  std::array<SpatialIndex, NB_CIBLES> reperes;
+  std::array<ClusterGraph, 2> hierarchies; // rats, chats
+  std::array<Voisinage, 2> voisinages; // rats, chats
 };
 
 std::ostream& operator<<(std::ostream& os, const Map&);
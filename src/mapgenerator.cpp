@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <functional>
+#include <ostream>
+#include <queue>
+#include <sstream>
+#include <vector>
+
+#include "map.h"
+#include "mapgenerator.h"
+
+using namespace std;
+
+const size_t MapGenerator::cote_max = 10000;
+
+MapGenerator::MapGenerator(const Parametres& p)
+    : parametres(p), alea { p.graine }, cases { }, murs { }, sorties { } {
+  parametres.salle = max<size_t>(parametres.salle, 3);
+}
+
+size_t MapGenerator::index(size_t x, size_t y) const noexcept {
+  return y * parametres.largeur + x;
+}
+
+uint32_t MapGenerator::tirer(uint32_t n) {
+  return alea() % n;
+}
+
+bool MapGenerator::chance(double p) {
+  return alea() < p * 4294967296.0;
+}
+
+bool MapGenerator::Generate() {
+  auto w = parametres.largeur, h = parametres.hauteur;
+  if (w < 3 || h < 3 || w > cote_max || h > cote_max) {
+    return false;
+  }
+  alea.seed(parametres.graine);
+  sorties = 0;
+  cases.assign(w * h, MUR);
+  auto cible = parametres.murs < 0 ? -1. : parametres.murs / 100.;
+  switch (parametres.topologie) {
+  case LABYRINTHE:
+    labyrinthe(cible);
+    break;
+  case SALLES:
+    salles(cible);
+    break;
+  default:
+    ouverte(cible < 0 ? .2 : cible);
+  }
+
+  percer(parametres.sorties);
+  size_t libres { };
+  for (size_t y = 1; y + 1 != h; ++y) {
+    for (size_t x = 1; x + 1 != w; ++x) {
+      libres += cases[index(x, y)] == VIDE;
+    }
+  }
+  if (parametres.rats + parametres.chats + parametres.fromages > libres) {
+    return false;
+  }
+  poser(RAT, parametres.rats);
+  poser(CHAT, parametres.chats);
+  poser(FROMAGE, parametres.fromages);
+  murs = static_cast<size_t>(count(begin(cases), end(cases), MUR));
+  return true;
+}
+
+void MapGenerator::ouverte(double p) {
+  for (size_t y = 1; y + 1 != parametres.hauteur; ++y) {
+    for (size_t x = 1; x + 1 != parametres.largeur; ++x) {
+      cases[index(x, y)] = chance(p) ? MUR : VIDE;
+    }
+  }
+  combler();
+}
+
+/*
+ Mure les poches isolees de la topologie ouverte pour ne garder que la plus
+ grande region libre : tous les elements poses s'y atteignent. Deux parcours
+ en largeur : le premier mesure les regions (marque 1), le second marque la
+ plus grande (marque 2).
+ */
+void MapGenerator::combler() {
+  auto w = parametres.largeur;
+  vector<char> marque(cases.size());
+  queue<size_t> file;
+  auto parcourir = [&](size_t depart, char m) {
+    size_t n { 1 };
+    marque[depart] = m;
+    file.push(depart);
+    while (!file.empty()) {
+      auto i = file.front();
+      file.pop();
+      for (auto j : { i - 1, i + 1, i - w, i + w }) { // la bordure arrete
+        if (cases[j] == VIDE && marque[j] != m) {
+          marque[j] = m;
+          ++n;
+          file.push(j);
+        }
+      }
+    }
+    return n;
+  };
+  size_t plus_grande { }, depart { };
+  for (size_t i = 0; i != cases.size(); ++i) {
+    if (cases[i] == VIDE && !marque[i]) {
+      auto n = parcourir(i, 1);
+      if (n > plus_grande) {
+        plus_grande = n;
+        depart = i;
+      }
+    }
+  }
+  if (!plus_grande) {
+    return;
+  }
+  parcourir(depart, 2);
+  for (size_t i = 0; i != cases.size(); ++i) {
+    if (cases[i] == VIDE && marque[i] != 2) {
+      cases[i] = MUR;
+    }
+  }
+}
+
+/*
+ Les cellules du labyrinthe sont les cases (2i+1, 2j+1) ; creuser vers une
+ voisine ouvre aussi la case qui les separe. Le labyrinthe parfait laisse
+ environ la moitie des cases en murs ; pour une cible plus basse, chaque mur
+ separant deux cellules est ouvert avec la meme probabilite, ce qui cree des
+ boucles sans jamais fermer de passage.
+ */
+void MapGenerator::labyrinthe(double cible) {
+  auto mw = (parametres.largeur - 1) / 2, mh = (parametres.hauteur - 1) / 2;
+  auto cellule = [&](size_t c) -> char& {
+    return cases[index(2 * (c % mw) + 1, 2 * (c / mw) + 1)];
+  };
+  vector<uint32_t> pile { 0 };
+  cellule(0) = VIDE;
+  uint32_t voisines[4];
+  while (!pile.empty()) {
+    auto c = pile.back();
+    auto cx = c % mw, cy = c / mw;
+    uint32_t n { };
+    if (cx > 0 && cellule(c - 1) == MUR) {
+      voisines[n++] = c - 1;
+    }
+    if (cx + 1 < mw && cellule(c + 1) == MUR) {
+      voisines[n++] = c + 1;
+    }
+    if (cy > 0 && cellule(c - mw) == MUR) {
+      voisines[n++] = static_cast<uint32_t>(c - mw);
+    }
+    if (cy + 1 < mh && cellule(c + mw) == MUR) {
+      voisines[n++] = static_cast<uint32_t>(c + mw);
+    }
+    if (!n) {
+      pile.pop_back();
+      continue;
+    }
+    auto v = voisines[tirer(n)];
+    cases[index(cx + v % mw + 1, cy + v / mw + 1)] = VIDE; // entre les deux
+    cellule(v) = VIDE;
+    pile.push_back(v);
+  }
+
+  if (cible < 0) {
+    return;
+  }
+  // murs de separation : une coordonnee paire, entre deux cellules
+  size_t total { }, separations { };
+  auto pour_separations = [&](const function<void(char&)>& f) {
+    for (size_t y = 1; y < 2 * mh; ++y) {
+      for (size_t x = 1 + y % 2; x < 2 * mw; x += 2) {
+        f(cases[index(x, y)]);
+      }
+    }
+  };
+  for (auto c : cases) {
+    total += c == MUR;
+  }
+  pour_separations([&](char& c) {separations += c == MUR;});
+  auto trop = static_cast<double>(total) - cible * cases.size();
+  if (trop > 0 && separations) {
+    auto p = min(1., trop / separations);
+    pour_separations([&](char& c) {
+      if (c == MUR && chance(p)) {
+        c = VIDE;
+      }
+    });
+  }
+}
+
+/*
+ Division recursive : les murs sont sur des coordonnees paires, les portes
+ sur des coordonnees impaires, si bien qu'un mur ne bute jamais sur la porte
+ d'un autre. Les piliers ajoutes pour atteindre la cible sont sur des cases
+ aux deux coordonnees paires : les rangees et colonnes impaires restent
+ libres dans chaque salle, qui reste donc connexe.
+ */
+void MapGenerator::salles(double cible) {
+  auto w = parametres.largeur, h = parametres.hauteur;
+  for (size_t y = 1; y + 1 != h; ++y) {
+    for (size_t x = 1; x + 1 != w; ++x) {
+      cases[index(x, y)] = VIDE;
+    }
+  }
+  struct Zone {
+    size_t x0, y0, x1, y1; // bornes comprises, x0 et y0 impairs
+  };
+  auto impair = [&](size_t a, size_t b) { // impair tire dans [a, b], a impair
+    return a + 2 * tirer(static_cast<uint32_t>((b - a) / 2 + 1));
+  };
+  // mur dans la moitie centrale de [a, b], pour eviter les salles en lamelles
+  auto milieu = [&](size_t a, size_t b) {
+    auto marge = (b - a) / 4 & ~size_t { 1 };
+    return impair(a + marge, b - marge) + 1;
+  };
+  vector<Zone> pile { { 1, 1, w - 2, h - 2 } };
+  while (!pile.empty()) {
+    auto z = pile.back();
+    pile.pop_back();
+    auto zw = z.x1 - z.x0 + 1, zh = z.y1 - z.y0 + 1;
+    if (zw <= parametres.salle && zh <= parametres.salle) {
+      continue;
+    }
+    if (zw >= zh) {
+      auto x = milieu(z.x0, z.x1 - 2);
+      auto porte = impair(z.y0, z.y1);
+      for (auto y = z.y0; y <= z.y1; ++y) {
+        if (y != porte) {
+          cases[index(x, y)] = MUR;
+        }
+      }
+      pile.push_back( { z.x0, z.y0, x - 1, z.y1 });
+      pile.push_back( { x + 1, z.y0, z.x1, z.y1 });
+    } else {
+      auto y = milieu(z.y0, z.y1 - 2);
+      auto porte = impair(z.x0, z.x1);
+      for (auto x = z.x0; x <= z.x1; ++x) {
+        if (x != porte) {
+          cases[index(x, y)] = MUR;
+        }
+      }
+      pile.push_back( { z.x0, z.y0, z.x1, y - 1 });
+      pile.push_back( { z.x0, y + 1, z.x1, z.y1 });
+    }
+  }
+
+  if (cible < 0) {
+    return;
+  }
+  size_t total { }, places { };
+  for (auto c : cases) {
+    total += c == MUR;
+  }
+  for (size_t y = 2; y + 1 < h; y += 2) {
+    for (size_t x = 2; x + 1 < w; x += 2) {
+      places += cases[index(x, y)] == VIDE;
+    }
+  }
+  auto manque = cible * cases.size() - static_cast<double>(total);
+  if (manque > 0 && places) {
+    auto p = min(1., manque / places);
+    for (size_t y = 2; y + 1 < h; y += 2) {
+      for (size_t x = 2; x + 1 < w; x += 2) {
+        auto& c = cases[index(x, y)];
+        if (c == VIDE && chance(p)) {
+          c = MUR;
+        }
+      }
+    }
+  }
+}
+
+/*
+ Tirages au hasard parmi les cases interieures, jusqu'a en trouver une
+ libre ; Generate a verifie qu'il y en a assez.
+ */
+size_t MapGenerator::poser(char c, size_t n) {
+  auto w = static_cast<uint32_t>(parametres.largeur - 2);
+  auto h = static_cast<uint32_t>(parametres.hauteur - 2);
+  for (size_t i = 0; i != n;) {
+    auto& cell = cases[index(tirer(w) + 1, tirer(h) + 1)];
+    if (cell == VIDE) {
+      cell = c;
+      ++i;
+    }
+  }
+  return n;
+}
+
+/*
+ Les sorties sont tirees parmi les cases de la bordure (coins exclus) dont la
+ voisine interieure est libre.
+ */
+void MapGenerator::percer(size_t n) {
+  auto w = parametres.largeur, h = parametres.hauteur;
+  vector<size_t> candidates;
+  auto essayer = [&](size_t x, size_t y, size_t xi, size_t yi) {
+    if (cases[index(xi, yi)] == VIDE) {
+      candidates.push_back(index(x, y));
+    }
+  };
+  for (size_t x = 1; x + 1 != w; ++x) {
+    essayer(x, 0, x, 1);
+    essayer(x, h - 1, x, h - 2);
+  }
+  for (size_t y = 1; y + 1 != h; ++y) {
+    essayer(0, y, 1, y);
+    essayer(w - 1, y, w - 2, y);
+  }
+  n = min(n, candidates.size());
+  for (size_t i = 0; i != n; ++i) {
+    swap(candidates[i],
+        candidates[i + tirer(static_cast<uint32_t>(candidates.size() - i))]);
+    cases[candidates[i]] = SORTIE;
+  }
+  sorties = n;
+}
+
+size_t MapGenerator::getExitCount() const noexcept {
+  return sorties;
+}
+
+double MapGenerator::getWallRatio() const noexcept {
+  return cases.empty() ? 0. : 100. * murs / cases.size();
+}
+
+void MapGenerator::Write(ostream& out) const {
+  for (size_t y = 0; y != parametres.hauteur; ++y) {
+    if (y) {
+      out.put('\n');
+    }
+    out.write(cases.data() + index(0, y),
+        static_cast<streamsize>(parametres.largeur));
+  }
+}
+
+string MapGenerator::str() const {
+  ostringstream out;
+  Write(out);
+  return out.str();
+}
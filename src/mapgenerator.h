@@ -0,0 +1,85 @@
+#ifndef MAPGENERATOR_H_
+#define MAPGENERATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <random>
+#include <string>
+
+/*
+ Generateur de cartes au format texte lu par Map::Map(istream&), pour les
+ essais a grande echelle (jusqu'a 10000 x 10000 cases).
+
+ La bordure est en murs, percee de sorties. L'interieur suit une topologie :
+   - OUVERTE : murs epars tires case par case, puis les poches isolees
+     murees pour ne garder que la plus grande region libre (au-dela de 35 %
+     environ, la proportion finale depasse donc nettement la cible) ;
+   - LABYRINTHE : labyrinthe parfait (parcours en profondeur) sur les cases de
+     coordonnees impaires, dont des murs de separation sont ensuite ouverts
+     pour creer des boucles ;
+   - SALLES : division recursive en salles d'au plus <salle> cases de cote,
+     chaque mur perce d'une porte, puis des piliers dans les salles.
+ Pour LABYRINTHE et SALLES, les murs ne sont ajoutes ou retires qu'a des
+ places qui gardent l'interieur connexe.
+
+ Une meme graine donne la meme carte, quelle que soit la bibliotheque
+ standard : les tirages n'utilisent que la suite de std::mt19937.
+ */
+class MapGenerator {
+public:
+  enum Topologie {
+    OUVERTE, LABYRINTHE, SALLES
+  };
+
+  struct Parametres {
+    std::size_t largeur = 64, hauteur = 32;
+    Topologie topologie = OUVERTE;
+    // proportion de murs visee, en %, negative pour celle de la topologie
+    int murs = -1;
+    std::size_t salle = 16;
+    std::size_t rats = 10, chats = 2, fromages = 10, sorties = 2;
+    std::uint32_t graine = 1;
+  };
+
+  static const std::size_t cote_max;
+
+  explicit MapGenerator(const Parametres&);
+
+  /*
+   Construit la carte. Retourne faux si les dimensions sont hors de
+   [3, cote_max] ou s'il n'y a pas assez de cases libres pour les elements
+   demandes ; moins de sorties que demande ne sont pas une erreur (voir
+   getExitCount).
+   */
+  bool Generate();
+
+  std::size_t getExitCount() const noexcept;
+  // proportion de murs obtenue, bordure comprise, en %
+  double getWallRatio() const noexcept;
+
+  /*
+   Ecrit la carte, une ligne par rangee, sans fin de ligne finale (comme les
+   cartes de cartes/).
+   */
+  void Write(std::ostream&) const;
+  std::string str() const;
+
+private:
+  std::size_t index(std::size_t x, std::size_t y) const noexcept;
+  std::uint32_t tirer(std::uint32_t n); // dans [0, n)
+  bool chance(double p); // vrai avec une probabilite p
+  void ouverte(double p);
+  void combler();
+  void labyrinthe(double p);
+  void salles(double p);
+  std::size_t poser(char c, std::size_t n);
+  void percer(std::size_t n);
+
+  Parametres parametres;
+  std::mt19937 alea;
+  std::string cases; // hauteur rangees de largeur cases, sans fins de ligne
+  std::size_t murs, sorties;
+};
+
+#endif /* MAPGENERATOR_H_ */
@@ -7,8 +7,8 @@
 
 #include <algorithm>
 #include <iostream>
-#include <cstring>
 #include <memory>
+#include <thread>
 #include <unistd.h>
 
 #include "mpi.h"
@@ -16,12 +16,12 @@
 using namespace std;
 
 mpi_message::mpi_message()
-    : tag { }, source { }, comment { }, comm { } {
+    : tag { }, source { }, comment { }, comm { }, latest { true } {
 }
 
 mpi_server::mpi_server(int *argc, char ***argv)
     : id_ { random_string(8) } {
-  MPI_Init(argc, argv);
+  MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &thread_level_);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
   MPI_Comm_size(MPI_COMM_WORLD, &size_);
   MPI_Comm_get_parent(&parent_);
@@ -44,6 +44,10 @@ mpi_server::~mpi_server() {
 #endif
 }
 
+int mpi_server::thread_level() const noexcept {
+  return thread_level_;
+}
+
 int mpi_server::rank() const noexcept {
   return rank_;
 }
@@ -82,39 +86,46 @@ size_t mpi_server::spawn(int qty, char* cmd, vector<char*> && args,
   return failed;
 }
 
+// messages may be binary (see wire.h), their size is the string's, not strlen's
 void mpi_server::send_string(MPI_Comm comm, int target, int tag, string &&msg) {
-  auto len = strlen(msg.c_str()) + 1;
-  unique_ptr<char[]> buff { new char[len] { } };
-  strcpy(buff.get(), msg.c_str());
-  MPI_Send(buff.get(), len - 1, MPI_CHAR, target, tag, comm);
+  MPI_Send(const_cast<char*>(msg.data()), msg.size(), MPI_CHAR, target, tag,
+      comm);
 }
 
-pair<char*, MPI_Request> mpi_server::forward_string(MPI_Comm comm, int target,
-    int tag, string &&msg) {
+MPI_Request mpi_server::forward_string(MPI_Comm comm, int target, int tag,
+    const string &msg) {
   MPI_Request reqs { };
-  char *buff;
-  try {
-    auto len = strlen(msg.c_str()) + 1;
-    buff = new char[len] { };
-    strcpy(buff, msg.c_str());
-    MPI_Isend(buff, len - 1, MPI_CHAR, target, tag, comm, &reqs);
-    return {buff, reqs};
-  } catch (...) {
-    delete[] buff;
-    throw;
-  }
+  MPI_Isend(const_cast<char*>(msg.data()), msg.size(), MPI_CHAR, target, tag,
+      comm, &reqs);
+  return reqs;
 }
 
 string mpi_server::recv_string(MPI_Comm comm, int source, int tag,
     MPI_Status* status) {
-  probe(comm, source, tag, status);
+  MPI_Message message;
+  MPI_Mprobe(source, tag, comm, &message, status);
+  string msg { };
+  recv_string(&message, status, msg);
+  return msg;
+}
+
+// the matched message can't be stolen by another receive in between, it is
+// received straight into <msg>, whose capacity is reused
+void mpi_server::recv_string(MPI_Message* message, MPI_Status* status,
+    string& msg) {
   int recv;
   MPI_Get_count(status, MPI_CHAR, &recv);
-  unique_ptr<char[]> buff { new char[recv] }; // clean up automatically
-  MPI_Recv(buff.get(), recv, MPI_CHAR, status->MPI_SOURCE, status->MPI_TAG,
-      comm, status);
-  string msg { buff.get(), buff.get() + recv };
-  return msg;
+  msg.resize(recv);
+  MPI_Mrecv(recv ? &msg[0] : nullptr, recv, MPI_CHAR, message, status);
+}
+
+void mpi_server::recv_matched(MPI_Comm comm, MPI_Message* message,
+    MPI_Status* status, mpi_message& mm) {
+  recv_string(message, status, mm.comment);
+  mm.source = status->MPI_SOURCE;
+  mm.tag = status->MPI_TAG;
+  mm.comm = comm;
+  mm.latest = true;
 }
 
 string mpi_server::recv_string(MPI_Comm comm, int source, int tag) {
@@ -127,31 +138,43 @@ void mpi_server::send_message(MPI_Comm comm, int target, int tag,
   send_string(comm, target, tag, move(comment));
 }
 
-std::pair<char*, MPI_Request> mpi_server::forward_message(MPI_Comm comm,
-    int target, int tag, std::string&& comment) {
-  return forward_string(comm, target, tag, move(comment));
+MPI_Request mpi_server::forward_message(MPI_Comm comm, int target, int tag,
+    const std::string& comment) {
+  return forward_string(comm, target, tag, comment);
 }
 
 mpi_message mpi_server::recv_message(MPI_Comm comm, int source, int tag) {
   mpi_message mm { };
-  MPI_Status status;
-  mm.comment = recv_string(comm, source, tag, &status);
-  mm.source = status.MPI_SOURCE;
-  mm.tag = status.MPI_TAG;
-  mm.comm = comm;
+  recv_message(comm, source, tag, mm);
   return mm;
 }
 
+void mpi_server::recv_message(MPI_Comm comm, int source, int tag,
+    mpi_message& mm) {
+  MPI_Status status;
+  MPI_Message message;
+  MPI_Mprobe(source, tag, comm, &message, &status);
+  recv_matched(comm, &message, &status, mm);
+}
+
+bool mpi_server::try_recv_message(MPI_Comm comm, int source, int tag,
+    mpi_message& mm) {
+  int flag;
+  MPI_Status status;
+  MPI_Message message;
+  MPI_Improbe(source, tag, comm, &flag, &message, &status);
+  if (flag) {
+    recv_matched(comm, &message, &status, mm);
+  }
+  return flag;
+}
+
 bool mpi_server::probe(const mpi_message& msg) const noexcept {
   return probe(msg.comm, msg.source, msg.tag);
 }
 bool mpi_server::probe(MPI_Comm comm, int source, int tag) const noexcept {
   int flag;
-  // Iprobe (almost) never returns true on the first call
-  // http://stackoverflow.com/q/34059832
-  for (int i = 0; i != 9; ++i) {
-    MPI_Iprobe(source, tag, comm, &flag, MPI_STATUS_IGNORE);
-  }
+  MPI_Iprobe(source, tag, comm, &flag, MPI_STATUS_IGNORE);
   return flag;
 }
 
@@ -161,17 +184,64 @@ bool mpi_server::probe(MPI_Comm comm, int source, int tag,
   return flag;
 }
 
+MPI_Comm mpi_server::merge(MPI_Comm intercomm, bool high) const {
+  MPI_Comm intracomm;
+  MPI_Intercomm_merge(intercomm, high, &intracomm);
+  return intracomm;
+}
+
+bool mpi_server::same_node(MPI_Comm comm) const {
+  MPI_Comm node;
+  int node_size, comm_size, all, local;
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+  MPI_Comm_size(node, &node_size);
+  MPI_Comm_size(comm, &comm_size);
+  MPI_Comm_free(&node);
+  local = node_size == comm_size;
+  MPI_Allreduce(&local, &all, 1, MPI_INT, MPI_LAND, comm);
+  return all;
+}
+
+mpi_shared_window::mpi_shared_window(MPI_Comm comm, MPI_Aint size)
+    : win_ { MPI_WIN_NULL }, base_ { }, size_ { } {
+  int rank, disp;
+  char* mine;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Win_allocate_shared(rank == 0 ? size : 0, 1, MPI_INFO_NULL, comm, &mine,
+      &win_);
+  MPI_Win_shared_query(win_, 0, &size_, &disp, &base_);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, win_);
+}
+
+mpi_shared_window::~mpi_shared_window() {
+  MPI_Win_unlock_all(win_);
+  MPI_Win_free(&win_);
+}
+
+char* mpi_shared_window::data() const noexcept {
+  return base_;
+}
+
+MPI_Aint mpi_shared_window::size() const noexcept {
+  return size_;
+}
+
+void mpi_shared_window::sync() const noexcept {
+  MPI_Win_sync(win_);
+}
+
 mpi_endpoint::mpi_endpoint(mpi_server* s, handler_type&& dh)
     : listenning { }, server { s }, pending_replies { max_reply_slots,
-    MPI_REQUEST_NULL }, pending_replies_buffer { max_reply_slots, nullptr }, reply_slots { }, routing_table { }, default_handler {
-        dh } {
+    MPI_REQUEST_NULL }, pending_replies_buffer(max_reply_slots), free_slots { }, completed(
+        max_reply_slots), spare_buffers { }, routing_table { }, default_handler {
+        dh }, inbox { }, seen { }, deadline { }, deadline_handler { }, watched { }, watch_handlers { } {
+  for (int i = max_reply_slots; i != 0; --i) {
+    free_slots.push_back(i - 1);
+  }
 }
 
 mpi_endpoint::~mpi_endpoint() {
   MPI_Waitall(pending_replies.size(), &pending_replies[0], MPI_STATUSES_IGNORE);
-  for (int i = 0; i != reply_slots; ++i) {
-    delete[] pending_replies_buffer[i];
-  }
 }
 
 void mpi_endpoint::add_handler(message_tag_type mt, handler_type&& h) {
@@ -181,21 +251,110 @@ void mpi_endpoint::add_handler(message_tag_type mt, handler_type&& h) {
 void mpi_endpoint::start(MPI_Comm comm) {
   listenning = true;
   while (listenning) {
-    mpi_message msg = server->recv_message(comm, MPI_ANY_SOURCE, MPI_ANY_TAG);
-    auto handler_range = routing_table.equal_range(msg.tag);
-    if (handler_range.first == handler_range.second) {
-      default_handler(msg);
+    // messages are received into the buffers of the previous pass
+    size_t received { };
+    auto next = [&]() -> mpi_message& {
+      if (received == inbox.size()) {
+        inbox.emplace_back();
+      }
+      return inbox[received];
+    };
+    if (deadline_handler || !watched.empty()) {
+      if (!poll(comm, next())) {
+        continue; // a deadline or watch handler was called instead
+      }
     } else {
-      for (auto it = handler_range.first; it != handler_range.second; ++it) {
-        it->second(msg);
+      server->recv_message(comm, MPI_ANY_SOURCE, MPI_ANY_TAG, next());
+    }
+    ++received;
+    // everything else already waiting is received in the same pass
+    while (server->try_recv_message(comm, MPI_ANY_SOURCE, MPI_ANY_TAG, next())) {
+      ++received;
+    }
+    // newest first: a message is the latest if its source and tag were not
+    // seen yet
+    auto last = begin(inbox) + received;
+    seen.clear();
+    for (auto it = last; it != begin(inbox);) {
+      --it;
+      auto key = static_cast<uint64_t>(static_cast<uint32_t>(it->source)) << 32
+          | static_cast<uint32_t>(it->tag);
+      it->latest = seen.insert(key).second;
+    }
+    for (auto it = begin(inbox); it != last; ++it) {
+      if (!listenning) {
+        break; // the remaining messages are dropped, as prune() would
       }
+      dispatch(*it);
+    }
+  }
+  inbox.clear();
+}
+
+// waits for a message, a watched request or the deadline, whichever comes
+// first, backing off between attempts
+bool mpi_endpoint::poll(MPI_Comm comm, mpi_message& msg) {
+  auto pause = chrono::microseconds { 10 };
+  for (;;) {
+    if (server->try_recv_message(comm, MPI_ANY_SOURCE, MPI_ANY_TAG, msg)) {
+      return true;
+    }
+    if (!watched.empty()) {
+      int done { };
+      // shared with reclaim(), sized for the reply slots
+      if (completed.size() < watched.size()) {
+        completed.resize(watched.size());
+      }
+      MPI_Testsome(watched.size(), &watched[0], &done, &completed[0],
+          MPI_STATUSES_IGNORE);
+      if (done != MPI_UNDEFINED && done != 0) {
+        // the handlers may watch new requests
+        vector<function<void()>> handlers;
+        for (int k = 0; k != done; ++k) {
+          handlers.push_back(move(watch_handlers[completed[k]]));
+        }
+        for (size_t i = watched.size(); i-- != 0;) {
+          if (watched[i] == MPI_REQUEST_NULL) {
+            watched.erase(begin(watched) + i);
+            watch_handlers.erase(begin(watch_handlers) + i);
+          }
+        }
+        for (auto& h : handlers) {
+          h();
+        }
+        return false;
+      }
+    }
+    auto now = clock_type::now();
+    if (deadline_handler && now >= deadline) {
+      auto handler = move(deadline_handler);
+      deadline_handler = nullptr;
+      handler();
+      return false;
+    }
+    if (deadline_handler) {
+      this_thread::sleep_for(min<clock_type::duration>(pause, deadline - now));
+    } else {
+      this_thread::sleep_for(pause);
+    }
+    pause = min(pause * 2, chrono::microseconds { 1000 });
+  }
+}
+
+void mpi_endpoint::dispatch(const mpi_message& msg) {
+  auto handler_range = routing_table.equal_range(msg.tag);
+  if (handler_range.first == handler_range.second) {
+    default_handler(msg);
+  } else {
+    for (auto it = handler_range.first; it != handler_range.second; ++it) {
+      it->second(msg);
     }
   }
 }
 
 void mpi_endpoint::prune(MPI_Comm comm) {
-  while (server->probe(comm, MPI_ANY_SOURCE, MPI_ANY_TAG)) {
-    server->recv_message(comm, MPI_ANY_SOURCE, MPI_ANY_TAG);
+  mpi_message msg { };
+  while (server->try_recv_message(comm, MPI_ANY_SOURCE, MPI_ANY_TAG, msg)) {
   }
   cout << *server << "Waiting Barrier..." << endl;
   MPI_Barrier(comm);
@@ -221,16 +380,76 @@ void mpi_endpoint::reply(const mpi_message& msg, int tag,
 
 void mpi_endpoint::reply(const mpi_message& msg, int source, int tag,
     std::string&& comment) {
-  auto reqs = server->forward_message(msg.comm, source, tag, move(comment));
-  int i = ++reply_slots;
-  if (i >= max_reply_slots) {
-    --reply_slots;
-    MPI_Waitany(pending_replies.size(), &pending_replies[0], &i,
-    MPI_STATUS_IGNORE);
-    delete[] pending_replies_buffer[i];
+  if (free_slots.empty()) {
+    reclaim(true);
+  }
+  int i = free_slots.back();
+  free_slots.pop_back();
+  pending_replies_buffer[i] = move(comment);
+  pending_replies[i] = server->forward_message(msg.comm, source, tag,
+      pending_replies_buffer[i]);
+}
+
+std::string mpi_endpoint::acquire_buffer() {
+  if (spare_buffers.empty() && free_slots.size() != pending_replies.size()) {
+    reclaim(false);
+  }
+  if (spare_buffers.empty()) {
+    return {};
+  }
+  auto buffer = move(spare_buffers.back());
+  spare_buffers.pop_back();
+  buffer.clear();
+  return buffer;
+}
+
+// frees the slots of completed replies, waits for at least one if <wait>
+void mpi_endpoint::reclaim(bool wait) {
+  int done { };
+  if (wait) {
+    MPI_Waitsome(pending_replies.size(), &pending_replies[0], &done,
+        &completed[0], MPI_STATUSES_IGNORE);
+  } else {
+    MPI_Testsome(pending_replies.size(), &pending_replies[0], &done,
+        &completed[0], MPI_STATUSES_IGNORE);
+  }
+  if (done == MPI_UNDEFINED) {
+    return;
+  }
+  for (int k = 0; k != done; ++k) {
+    int i = completed[k];
+    free_slots.push_back(i);
+    if (spare_buffers.size() < max_reply_slots) {
+      spare_buffers.push_back(move(pending_replies_buffer[i]));
+    }
+  }
+}
+
+void mpi_endpoint::set_deadline(clock_type::time_point d,
+    std::function<void()>&& h) {
+  deadline = d;
+  deadline_handler = move(h);
+}
+
+void mpi_endpoint::cancel_deadline() {
+  deadline_handler = nullptr;
+}
+
+void mpi_endpoint::watch(MPI_Request request, std::function<void()>&& h) {
+  watched.push_back(request);
+  watch_handlers.push_back(move(h));
+}
+
+void mpi_endpoint::complete_watched() {
+  while (!watched.empty()) {
+    MPI_Waitall(watched.size(), &watched[0], MPI_STATUSES_IGNORE);
+    auto handlers = move(watch_handlers);
+    watched.clear();
+    watch_handlers.clear();
+    for (auto& h : handlers) {
+      h();
+    }
   }
-  pending_replies_buffer[i] = reqs.first;
-  pending_replies[i] = reqs.second;
 }
 
 void mpi_endpoint::request_stop() {
@@ -238,11 +457,23 @@ void mpi_endpoint::request_stop() {
 #if MPI_VERBOSE
   cout << *server << "Stopping..." << endl;
 #endif
-  MPI_Waitall(pending_replies.size(), &pending_replies[0], MPI_STATUSES_IGNORE);
+  // through reclaim, so that a reply sent after the stop still finds its
+  // slots and buffers free
+  while (free_slots.size() != pending_replies.size()) {
+    reclaim(true);
+  }
 }
 
 mpi_unique_comm::~mpi_unique_comm() {
-  MPI_Comm_disconnect(&comm);
+  if (comm != MPI_COMM_NULL) {
+    MPI_Comm_disconnect(&comm);
+  }
+}
+
+mpi_local_comm::~mpi_local_comm() {
+  if (comm != MPI_COMM_NULL) {
+    MPI_Comm_free(&comm);
+  }
 }
 
 std::ostream& operator<<(std::ostream& os, const mpi_server& that) {
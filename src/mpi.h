@@ -10,10 +10,13 @@
 
 #include <mpi/mpi.h>
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <queue>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #define MPI_VERBOSE 1
@@ -22,7 +25,7 @@
  #helper
  */
 enum mpi_message_tag {
-  MMT_LOG, MMT_STOP, MMT_BECOME, MMT_DO, MMT_SPECIAL
+  MMT_LOG, MMT_STOP, MMT_BECOME, MMT_DO, MMT_SPECIAL, MMT_SYNC
 };
 
 /*
@@ -33,6 +36,7 @@ struct mpi_message {
   int tag, source; // not an MPI_Status!
   std::string comment;
   MPI_Comm comm;
+  bool latest; // false if a newer message of same source and tag was already received
   mpi_message();
 };
 
@@ -44,20 +48,30 @@ class mpi_server {
   MPI_Comm parent_;
   int rank_;
   int size_;
+  int thread_level_;
   /*
    Internal functions. close your eyes.
    */
   void send_string(MPI_Comm comm, int target, int tag, std::string&&);
-  std::pair<char*, MPI_Request> forward_string(MPI_Comm comm, int target,
-      int tag, std::string&&);
+  MPI_Request forward_string(MPI_Comm comm, int target, int tag,
+      const std::string&);
   std::string recv_string(MPI_Comm comm, int source, int tag,
       MPI_Status* status);
   std::string recv_string(MPI_Comm comm, int source, int tag);
+  void recv_string(MPI_Message* message, MPI_Status* status, std::string&);
+  void recv_matched(MPI_Comm comm, MPI_Message* message, MPI_Status* status,
+      mpi_message& mm);
 public:
   mpi_server(int *argc, char ***argv);
   mpi_server(const mpi_server&) = delete;
   ~mpi_server();
 
+  /*
+   Thread support provided by MPI, at most MPI_THREAD_FUNNELED is asked for: only
+   the thread that constructed the mpi_server makes MPI calls.
+   */
+  int thread_level() const noexcept;
+
   /*
    MPI rank of current process.
    */
@@ -96,18 +110,27 @@ public:
   void send_message(MPI_Comm comm, int target, int tag, std::string&&);
 
   /*
-   Forwards an std::string using the mpi_message™ protocol.
+   Forwards an std::string using the mpi_message™ protocol, straight from its buffer.
    #Non-Blocking-call returns immediately and the message is not guaranteed to be
-   sent until all <MPI_Request>s returned have been acted upon.
+   sent until the <MPI_Request> returned has been acted upon. The std::string must
+   neither be modified nor destroyed before then.
    */
-  std::pair<char*, MPI_Request> forward_message(MPI_Comm comm, int target,
-      int tag, std::string&&);
+  MPI_Request forward_message(MPI_Comm comm, int target, int tag,
+      const std::string&);
 
   /*
-   Receives an mpi_message™.
+   Receives an mpi_message™, the comment of <mm> is reused as the receive buffer.
    #Blocking-call until a message is received.
    */
   mpi_message recv_message(MPI_Comm comm, int source, int tag);
+  void recv_message(MPI_Comm comm, int source, int tag, mpi_message& mm);
+
+  /*
+   Receives an mpi_message™ into <mm> if one is already waiting on the channel.
+   The comment of <mm> is reused as the receive buffer.
+   #Non-Blocking-call returns false immediately otherwise.
+   */
+  bool try_recv_message(MPI_Comm comm, int source, int tag, mpi_message& mm);
 
   /*
    Probes the channel (communicator, tag, source) used the send an mpi_message™ and
@@ -122,6 +145,46 @@ public:
   bool probe(MPI_Comm comm, int source, int tag) const noexcept;
   bool probe(MPI_Comm comm, int source, int tag, MPI_Status * status) const
       noexcept;
+
+  /*
+   Merges an intercommunicator into an intracommunicator, the <high> group is ordered last.
+   #Collective-call over both groups.
+   */
+  MPI_Comm merge(MPI_Comm intercomm, bool high) const;
+
+  /*
+   True if every process of <comm> runs on the same node as this one.
+   #Collective-call over <comm>.
+   */
+  bool same_node(MPI_Comm comm) const;
+};
+
+/*
+ Memory segment allocated by rank 0 of an intracommunicator and mapped in
+ every process of that communicator (MPI-3 shared window). All processes must
+ be on the same node, see mpi_server::same_node().
+ The window is locked for passive access during its whole life.
+ */
+class mpi_shared_window {
+  MPI_Win win_;
+  char* base_;
+  MPI_Aint size_;
+public:
+  /*
+   #Collective-call over <comm>, only rank 0's <size> is used.
+   */
+  mpi_shared_window(MPI_Comm comm, MPI_Aint size);
+  mpi_shared_window(const mpi_shared_window&) = delete;
+  /*
+   #Collective-call over the communicator used at construction.
+   */
+  ~mpi_shared_window();
+  char* data() const noexcept;
+  MPI_Aint size() const noexcept;
+  /*
+   Synchronizes the private and public copies of the window (memory barrier).
+   */
+  void sync() const noexcept;
 };
 
 /*
@@ -133,6 +196,10 @@ public:
  construction if no handler is available for the received mpi_message™ tag.
  More than one handler can be added for any given tag, the order in
  which they are called is unspecified.
+ Every mpi_message™ already waiting is received in one pass before the
+ handlers are called, in order of arrival, so that a handler can tell
+ from mpi_message::latest whether a newer one of the same source and tag
+ follows and skip stale work.
  */
 class mpi_endpoint {
 public:
@@ -173,6 +240,34 @@ public:
   void reply(const mpi_message& msg, int tag, std::string&&);
   void reply(const mpi_message& msg, int source, int tag, std::string&&);
 
+  /*
+   Empty std::string, recycled from a completed reply when possible, to build the
+   next reply into without allocating.
+   */
+  std::string acquire_buffer();
+
+  /*
+   Calls <handler> from start() once <deadline> is reached, unless cancelled before.
+   Replaces any previous deadline. While a deadline is pending, start() polls the
+   communicator, backing off up to the deadline, instead of blocking in a receive.
+   */
+  using clock_type = std::chrono::steady_clock;
+  void set_deadline(clock_type::time_point deadline, std::function<void()>&&);
+  void cancel_deadline();
+
+  /*
+   Calls <handler> from start() once <request> (e.g. a nonblocking collective) completes.
+   While requests are watched, start() polls the communicator and them, backing off
+   between attempts, instead of blocking in a receive.
+   */
+  void watch(MPI_Request request, std::function<void()>&&);
+
+  /*
+   Waits for every watched request and calls their handlers, e.g. once start() returned.
+   #Blocking-call
+   */
+  void complete_watched();
+
   /*
    Kindly asks the mpi_endpoint to stop. All remaining handlers for the current mpi_message™
    will be called before the mpi_endpoint stops but, no more mpi_message™ will be received.
@@ -181,29 +276,58 @@ public:
   bool listenning;
   mpi_server* server;
 
+  /*
+   A reply is sent straight from the std::string it was given, which is kept in
+   its slot until the send completes, then moved to the spare buffers.
+   */
   static const int max_reply_slots = 1024;
   using pending_replies_type = std::vector<MPI_Request>;
-  using pending_replies_buffer_type = std::vector<char*>;
+  using pending_replies_buffer_type = std::vector<std::string>;
   pending_replies_type pending_replies;
   pending_replies_buffer_type pending_replies_buffer;
-  int reply_slots;
+  std::vector<int> free_slots;
+  std::vector<int> completed; // indices filled by MPI_Testsome/Waitsome
+  std::vector<std::string> spare_buffers;
+  void reclaim(bool wait);
 
   using routing_table_type = std::unordered_multimap<message_tag_type, handler_type>;
   routing_table_type routing_table;
   handler_type default_handler;
+
+  std::vector<mpi_message> inbox; // messages of the current pass, reused with their buffers
+  std::unordered_set<std::uint64_t> seen; // (source, tag) of the pass, for latest
+  void dispatch(const mpi_message&);
+  bool poll(MPI_Comm, mpi_message&);
+
+  clock_type::time_point deadline;
+  std::function<void()> deadline_handler;
+
+  std::vector<MPI_Request> watched;
+  std::vector<std::function<void()>> watch_handlers;
 };
 
 /*
  Single use communicator, get's disconnected by the dtor.
  */
 struct mpi_unique_comm {
-  MPI_Comm comm;
+  MPI_Comm comm = MPI_COMM_NULL;
   mpi_unique_comm() = default;
   mpi_unique_comm(const mpi_unique_comm&) = delete;
   mpi_unique_comm& operator=(const mpi_unique_comm&) = delete;
   ~mpi_unique_comm();
 };
 
+/*
+ Communicator derived locally (merge, split...), get's freed by the dtor.
+ */
+struct mpi_local_comm {
+  MPI_Comm comm = MPI_COMM_NULL;
+  mpi_local_comm() = default;
+  mpi_local_comm(const mpi_local_comm&) = delete;
+  mpi_local_comm& operator=(const mpi_local_comm&) = delete;
+  ~mpi_local_comm();
+};
+
 std::ostream& operator<<(std::ostream& os, const mpi_server& that);
 std::string random_string(size_t length);
 
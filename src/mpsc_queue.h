@@ -0,0 +1,94 @@
+/*
+ * mpsc_queue.h
+ *
+ * Bounded lock-free queue, many producers and a single consumer.
+ */
+
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*
+ Ring of slots stamped with a sequence number (D. Vyukov's bounded queue): a
+ producer claims a slot with a single compare-and-swap on the tail, writes
+ it, then publishes it by bumping the slot's sequence. The consumer is
+ alone on the head and never writes to the tail.
+ */
+template<class T>
+class mpsc_queue {
+public:
+  /*
+   <capacity> is rounded up to a power of 2.
+   */
+  explicit mpsc_queue(std::size_t capacity)
+      : slots_(round_up(capacity)), mask_ { slots_.size() - 1 }, head_ { },
+          tail_ { } {
+    for (std::size_t i = 0; i != slots_.size(); ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  mpsc_queue(const mpsc_queue&) = delete;
+
+  /*
+   Any thread. Returns false, and drops nothing, if the queue is full.
+   */
+  bool push(const T& value) noexcept {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& slot = slots_[tail & mask_];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence)
+          - static_cast<std::ptrdiff_t>(tail);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(tail, tail + 1,
+            std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.sequence.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /*
+   Consumer thread only. Returns false if the queue is empty.
+   */
+  bool pop(T& value) noexcept {
+    auto& slot = slots_[head_ & mask_];
+    auto sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != head_ + 1) {
+      return false;
+    }
+    value = slot.value;
+    slot.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+private:
+  struct slot_type {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+  static std::size_t round_up(std::size_t n) {
+    std::size_t p = 2;
+    while (p < n) {
+      p *= 2;
+    }
+    return p;
+  }
+
+  std::vector<slot_type> slots_;
+  std::size_t mask_;
+  std::size_t head_; // consumer only
+  alignas(64) std::atomic<std::size_t> tail_;
+};
+
+#endif /* MPSC_QUEUE_H_ */
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <limits>
+
+#include "pathfinder.h"
+
+using namespace std;
+
+namespace {
+
+const PathFinder::cost_type droit = 10, diagonal = 14;
+const PathFinder::index_type aucun = numeric_limits<PathFinder::index_type>::max();
+
+PathFinder::cost_type octile(const Position& a, const Position& b) {
+  auto dx = abs(a.getX() - b.getX()), dy = abs(a.getY() - b.getY());
+  return droit * max(dx, dy) + (diagonal - droit) * min(dx, dy);
+}
+
+int signe(int v) {
+  return (v > 0) - (v < 0);
+}
+
+}
+
+PathFinder::PathFinder()
+    : generation { }, vu { }, ferme { }, cible { }, gCost { }, previous { },
+        ouverts { }, file { }, expansions { } {
+}
+
+bool PathFinder::NoeudPlusCher::operator()(const Noeud& a, const Noeud& b) const
+    noexcept {
+  // a egalite de f, on prefere le noeud le plus avance (g le plus grand)
+  return a.f > b.f || (a.f == b.f && a.g < b.g);
+}
+
+void PathFinder::prepare(size_t cells) {
+  if (vu.size() < cells) {
+    vu.assign(cells, 0);
+    ferme.assign(cells, 0);
+    cible.assign(cells, 0);
+    gCost.resize(cells);
+    previous.resize(cells);
+    generation = 0;
+  }
+  if (++generation == 0) { // debordement : on repart de zero
+    fill(begin(vu), end(vu), 0);
+    fill(begin(ferme), end(ferme), 0);
+    fill(begin(cible), end(cible), 0);
+    generation = 1;
+  }
+  ouverts.clear();
+  file.clear();
+  expansions = 0;
+}
+
+bool PathFinder::seen(index_type i) const noexcept {
+  return vu[i] == generation;
+}
+
+bool PathFinder::closed(index_type i) const noexcept {
+  return ferme[i] == generation;
+}
+
+void PathFinder::open(index_type i, cost_type g, cost_type h,
+    index_type parent) {
+  vu[i] = generation;
+  gCost[i] = g;
+  previous[i] = parent;
+  ouverts.push_back(Noeud { g + h, g, i });
+  push_heap(begin(ouverts), end(ouverts), NoeudPlusCher { });
+}
+
+PathFinder::Noeud PathFinder::pop() {
+  pop_heap(begin(ouverts), end(ouverts), NoeudPlusCher { });
+  auto n = ouverts.back();
+  ouverts.pop_back();
+  return n;
+}
+
+Position PathFinder::walkBack(const Map& map, index_type source,
+    index_type dest) const {
+  auto current = dest;
+  while (previous[current] != source) {
+    current = previous[current];
+  }
+  return map.getPosition(current);
+}
+
+Position PathFinder::FirstStep(const Map& map, const Position& sourcePosition,
+    const Position& destPosition) {
+  prepare(map.getCellCount());
+  if (sourcePosition == destPosition || !map.contains(sourcePosition)
+      || !map.contains(destPosition)) {
+    return sourcePosition;
+  }
+  auto type = map.showPosition(sourcePosition);
+  auto source = map.getIndex(sourcePosition), dest = map.getIndex(
+      destPosition);
+  auto& offsets = map.getNeighbourOffsets();
+
+  open(source, 0, Map::ManhattanDistance(sourcePosition, destPosition),
+      source);
+  while (!ouverts.empty()) {
+    auto n = pop();
+    if (closed(n.index)) {
+      continue; // entree perimee, la case a deja ete developpee
+    }
+    ferme[n.index] = generation;
+    if (n.index == dest) {
+      return walkBack(map, source, dest);
+    }
+    ++expansions;
+    for (auto it = begin(offsets); it != begin(offsets) + 4; ++it) {
+      auto voisin = n.index + *it;
+      if (closed(voisin) || !Map::isWalkable(type, map.showIndex(voisin))) {
+        continue;
+      }
+      auto g = n.g + 1;
+      if (!seen(voisin) || g < gCost[voisin]) {
+        auto h = Map::ManhattanDistance(map.getPosition(voisin), destPosition);
+        open(voisin, g, h, n.index);
+      }
+    }
+  }
+  return sourcePosition;
+}
+
+Position PathFinder::FirstStepToNearest(const Map& map,
+    const Position& sourcePosition, const vector<Position>& goals) {
+  prepare(map.getCellCount());
+  if (!map.contains(sourcePosition)) {
+    return sourcePosition;
+  }
+  for (auto& g : goals) {
+    if (g == sourcePosition) {
+      return sourcePosition;
+    }
+    if (map.contains(g)) {
+      cible[map.getIndex(g)] = generation;
+    }
+  }
+  auto type = map.showPosition(sourcePosition);
+  auto source = map.getIndex(sourcePosition);
+  auto& offsets = map.getNeighbourOffsets();
+
+  // cout uniforme : la premiere cible decouverte est la plus proche
+  vu[source] = generation;
+  previous[source] = source;
+  file.push_back(source);
+  for (size_t tete = 0; tete != file.size(); ++tete) {
+    auto courant = file[tete];
+    ++expansions;
+    for (auto it = begin(offsets); it != begin(offsets) + 4; ++it) {
+      auto voisin = courant + *it;
+      if (seen(voisin) || !Map::isWalkable(type, map.showIndex(voisin))) {
+        continue;
+      }
+      vu[voisin] = generation;
+      previous[voisin] = courant;
+      if (cible[voisin] == generation) {
+        return walkBack(map, source, voisin);
+      }
+      file.push_back(voisin);
+    }
+  }
+  return sourcePosition;
+}
+
+Position PathFinder::FirstStep8(const Map& map, const Position& sourcePosition,
+    const Position& destPosition) {
+  prepare(map.getCellCount());
+  if (sourcePosition == destPosition || !map.contains(sourcePosition)
+      || !map.contains(destPosition)) {
+    return sourcePosition;
+  }
+  auto type = map.showPosition(sourcePosition);
+  auto source = map.getIndex(sourcePosition), dest = map.getIndex(
+      destPosition);
+  auto& offsets = map.getNeighbourOffsets();
+  // cases droites longees par chaque diagonale : SE, NE, NW, SW
+  const int longees[4][2] { { 0, 2 }, { 1, 2 }, { 1, 3 }, { 0, 3 } };
+  auto libre = [&](index_type i) {
+    return Map::isWalkable(type, map.showIndex(i));
+  };
+
+  open(source, 0, octile(sourcePosition, destPosition), source);
+  while (!ouverts.empty()) {
+    auto n = pop();
+    if (closed(n.index)) {
+      continue;
+    }
+    ferme[n.index] = generation;
+    if (n.index == dest) {
+      return walkBack(map, source, dest);
+    }
+    ++expansions;
+    for (int k = 0; k != 8; ++k) {
+      auto voisin = n.index + offsets[k];
+      if (closed(voisin) || !libre(voisin)) {
+        continue;
+      }
+      if (k >= 4 && !(libre(n.index + offsets[longees[k - 4][0]])
+          && libre(n.index + offsets[longees[k - 4][1]]))) {
+        continue;
+      }
+      auto g = n.g + (k < 4 ? droit : diagonal);
+      if (!seen(voisin) || g < gCost[voisin]) {
+        open(voisin, g, octile(map.getPosition(voisin), destPosition),
+            n.index);
+      }
+    }
+  }
+  return sourcePosition;
+}
+
+/*
+ Avance depuis i dans la direction (dx, dy) jusqu'au prochain point de saut :
+ la destination, une case ou un voisin force apparait, ou, en diagonale, une
+ case d'ou un saut droit trouve un point de saut. Retourne aucun si la ligne
+ bute sur un obstacle.
+ */
+PathFinder::index_type PathFinder::jump(const Map& map, char type,
+    index_type i, int dx, int dy, index_type dest) const {
+  auto s = map.getNeighbourOffsets()[0]; // une ligne plus bas
+  auto libre = [&](index_type j) {
+    return Map::isWalkable(type, map.showIndex(j));
+  };
+  for (;; i += dx + dy * s) {
+    if (!libre(i)) {
+      return aucun;
+    }
+    if (i == dest) {
+      return i;
+    }
+    if (dx && dy) {
+      if (jump(map, type, i + dx, dx, 0, dest) != aucun
+          || jump(map, type, i + dy * s, 0, dy, dest) != aucun) {
+        return i;
+      }
+      if (!libre(i + dx) || !libre(i + dy * s)) {
+        return aucun; // pas de coin coupe
+      }
+    } else if (dx) {
+      if ((libre(i - s) && !libre(i - dx - s))
+          || (libre(i + s) && !libre(i - dx + s))) {
+        return i;
+      }
+    } else if ((libre(i - 1) && !libre(i - 1 - dy * s))
+        || (libre(i + 1) && !libre(i + 1 - dy * s))) {
+      return i;
+    }
+  }
+}
+
+Position PathFinder::FirstStepJPS(const Map& map,
+    const Position& sourcePosition, const Position& destPosition) {
+  prepare(map.getCellCount());
+  if (sourcePosition == destPosition || !map.contains(sourcePosition)
+      || !map.contains(destPosition)) {
+    return sourcePosition;
+  }
+  auto type = map.showPosition(sourcePosition);
+  auto source = map.getIndex(sourcePosition), dest = map.getIndex(
+      destPosition);
+  auto s = map.getNeighbourOffsets()[0];
+  auto libre = [&](index_type i) {
+    return Map::isWalkable(type, map.showIndex(i));
+  };
+  int directions[8][2];
+  int nb;
+  auto pousser = [&](int dx, int dy) {
+    directions[nb][0] = dx;
+    directions[nb][1] = dy;
+    ++nb;
+  };
+
+  open(source, 0, octile(sourcePosition, destPosition), source);
+  while (!ouverts.empty()) {
+    auto n = pop();
+    if (closed(n.index)) {
+      continue;
+    }
+    ferme[n.index] = generation;
+    if (n.index == dest) {
+      // le premier point de saut est en ligne droite ou en diagonale
+      auto premier = dest;
+      while (previous[premier] != source) {
+        premier = previous[premier];
+      }
+      auto p = map.getPosition(premier);
+      return Position { sourcePosition.getX()
+          + signe(p.getX() - sourcePosition.getX()), sourcePosition.getY()
+          + signe(p.getY() - sourcePosition.getY()) };
+    }
+    ++expansions;
+
+    // voisins a explorer, selon la direction d'arrivee
+    auto i = n.index;
+    auto ici = map.getPosition(i);
+    nb = 0;
+    if (i == source) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          if ((dx || dy) && libre(i + dx + dy * s)
+              && (!dx || !dy || (libre(i + dx) && libre(i + dy * s)))) {
+            pousser(dx, dy);
+          }
+        }
+      }
+    } else {
+      auto avant = map.getPosition(previous[i]);
+      auto dx = signe(ici.getX() - avant.getX()), dy = signe(
+          ici.getY() - avant.getY());
+      if (dx && dy) {
+        auto vertical = libre(i + dy * s), horizontal = libre(i + dx);
+        if (vertical) {
+          pousser(0, dy);
+        }
+        if (horizontal) {
+          pousser(dx, 0);
+        }
+        if (vertical && horizontal) {
+          pousser(dx, dy);
+        }
+      } else if (dx) {
+        auto bas = libre(i + s), haut = libre(i - s);
+        if (libre(i + dx)) {
+          pousser(dx, 0);
+          if (bas) {
+            pousser(dx, 1);
+          }
+          if (haut) {
+            pousser(dx, -1);
+          }
+        }
+        if (bas) {
+          pousser(0, 1);
+        }
+        if (haut) {
+          pousser(0, -1);
+        }
+      } else {
+        auto droite = libre(i + 1), gauche = libre(i - 1);
+        if (libre(i + dy * s)) {
+          pousser(0, dy);
+          if (droite) {
+            pousser(1, dy);
+          }
+          if (gauche) {
+            pousser(-1, dy);
+          }
+        }
+        if (droite) {
+          pousser(1, 0);
+        }
+        if (gauche) {
+          pousser(-1, 0);
+        }
+      }
+    }
+
+    for (int d = 0; d != nb; ++d) {
+      auto dx = directions[d][0], dy = directions[d][1];
+      auto saut = jump(map, type, i + dx + dy * s, dx, dy, dest);
+      if (saut == aucun || closed(saut)) {
+        continue;
+      }
+      auto p = map.getPosition(saut);
+      auto g = n.g + octile(ici, p);
+      if (!seen(saut) || g < gCost[saut]) {
+        open(saut, g, octile(p, destPosition), i);
+      }
+    }
+  }
+  return sourcePosition;
+}
+
+size_t PathFinder::getExpansions() const noexcept {
+  return expansions;
+}
+
+PathFinder& PathFinder::local() {
+  thread_local PathFinder pf;
+  return pf;
+}
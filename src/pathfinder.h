@@ -0,0 +1,101 @@
+#ifndef PATHFINDER_H_
+#define PATHFINDER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "map.h"
+#include "position.h"
+
+/*
+ Espace de travail reutilisable pour les recherches de chemin sur une Map.
+
+ Les couts et les parents sont indexes par case de la grille et marques d'une
+ generation : demarrer une nouvelle recherche ne fait qu'incrementer la
+ generation courante. Une fois les tableaux dimensionnes pour la plus grande
+ carte rencontree, une recherche ne fait plus aucune allocation.
+
+ Une instance n'est pas partagee entre fils d'execution, voir local().
+ */
+class PathFinder {
+public:
+  using index_type = Map::index_type;
+  using cost_type = std::int32_t;
+
+  PathFinder();
+  PathFinder(const PathFinder&) = delete;
+  PathFinder& operator=(const PathFinder&) = delete;
+
+  /*
+   Premiere position du plus court chemin (A*, heuristique de Manhattan) de
+   <source> vers <dest> pour l'element present en <source>.
+   Retourne <source> si <dest> est inatteignable ou confondue avec <source>.
+   */
+  Position FirstStep(const Map&, const Position& source, const Position& dest);
+
+  /*
+   Comme FirstStep, en 8-connexite : un pas en diagonale coute 14, un pas
+   droit 10 (heuristique octile), et la diagonale n'est permise que si les
+   deux cases droites qu'elle longe sont libres (pas de coin coupe).
+   */
+  Position FirstStep8(const Map&, const Position& source, const Position& dest);
+
+  /*
+   Chemin de meme cout que FirstStep8, par Jump Point Search (le premier pas
+   peut differer entre chemins optimaux a egalite) : sur une grille a cout
+   uniforme, seuls les points de saut (ou un voisin force apparait) entrent
+   dans le tas, les lignes droites et diagonales entre eux sont balayees
+   sans y passer.
+   */
+  Position FirstStepJPS(const Map&, const Position& source,
+      const Position& dest);
+
+  /*
+   Premiere position du plus court chemin de <source> vers la plus proche des
+   <goals> atteignables (parcours en largeur unique, arrete a la premiere cible
+   rencontree). Retourne <source> si aucune cible n'est atteignable ou si
+   <source> est elle-meme une cible.
+   */
+  Position FirstStepToNearest(const Map&, const Position& source,
+      const std::vector<Position>& goals);
+
+  /*
+   Nombre de cases developpees par la derniere recherche.
+   */
+  std::size_t getExpansions() const noexcept;
+
+  /*
+   Espace de travail propre au fil d'execution appelant.
+   */
+  static PathFinder& local();
+
+private:
+  struct Noeud {
+    cost_type f, g;
+    index_type index;
+  };
+  struct NoeudPlusCher {
+    bool operator()(const Noeud&, const Noeud&) const noexcept;
+  };
+
+  void prepare(std::size_t cells);
+  bool seen(index_type) const noexcept;
+  bool closed(index_type) const noexcept;
+  void open(index_type, cost_type g, cost_type h, index_type parent);
+  Noeud pop();
+  Position walkBack(const Map&, index_type source, index_type dest) const;
+  index_type jump(const Map&, char type, index_type i, int dx, int dy,
+      index_type dest) const;
+
+  std::uint32_t generation;
+  std::vector<std::uint32_t> vu; // generation a laquelle la case a ete atteinte
+  std::vector<std::uint32_t> ferme; // generation a laquelle la case a ete fermee
+  std::vector<std::uint32_t> cible; // generation a laquelle la case est une cible
+  std::vector<cost_type> gCost;
+  std::vector<index_type> previous;
+  std::vector<Noeud> ouverts; // tas binaire, sa capacite est conservee
+  std::vector<index_type> file; // file du parcours en largeur
+  std::size_t expansions;
+};
+
+#endif /* PATHFINDER_H_ */
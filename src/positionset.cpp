@@ -0,0 +1,65 @@
+#include "positionset.h"
+
+using namespace std;
+
+PositionSet::PositionSet()
+    : dense { }, cases { }, place { } {
+}
+
+void PositionSet::reset(size_t cells) {
+  dense.clear();
+  cases.clear();
+  place.assign(cells, -1);
+}
+
+void PositionSet::insert(const Position& pos, index_type cell) {
+  if (place[cell] >= 0) {
+    return;
+  }
+  place[cell] = static_cast<int>(dense.size());
+  dense.push_back(pos);
+  cases.push_back(cell);
+}
+
+void PositionSet::erase(index_type cell) {
+  auto p = place[cell];
+  if (p < 0) {
+    return;
+  }
+  auto dernier = cases.back();
+  dense[p] = dense.back();
+  cases[p] = dernier;
+  place[dernier] = p;
+  dense.pop_back();
+  cases.pop_back();
+  place[cell] = -1;
+}
+
+void PositionSet::move(index_type from, const Position& pos, index_type cell) {
+  auto p = place[from];
+  if (p < 0 || from == cell) {
+    return;
+  }
+  erase(cell);
+  p = place[from]; // erase a pu deplacer l'element
+  place[from] = -1;
+  place[cell] = p;
+  dense[p] = pos;
+  cases[p] = cell;
+}
+
+bool PositionSet::contains(index_type cell) const noexcept {
+  return cell < place.size() && place[cell] >= 0;
+}
+
+size_t PositionSet::size() const noexcept {
+  return dense.size();
+}
+
+bool PositionSet::empty() const noexcept {
+  return dense.empty();
+}
+
+const vector<Position>& PositionSet::elements() const noexcept {
+  return dense;
+}
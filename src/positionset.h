@@ -0,0 +1,43 @@
+#ifndef POSITIONSET_H_
+#define POSITIONSET_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "position.h"
+
+/*
+ Ensemble de positions d'une grille, sans ordre.
+
+ Les positions sont rangees dans un tableau dense, et chaque case de la
+ grille connait sa place dans ce tableau : l'appartenance, l'ajout, le
+ deplacement et le retrait (le dernier element prend la place liberee) se
+ font en temps constant, et le tableau se parcourt comme un vector.
+ */
+class PositionSet {
+public:
+  using index_type = std::size_t;
+
+  PositionSet();
+
+  /*
+   Vide l'ensemble pour une grille de <cells> cases.
+   */
+  void reset(std::size_t cells);
+  // sans effet si la case est deja dans l'ensemble
+  void insert(const Position&, index_type cell);
+  // sans effet si la case n'est pas dans l'ensemble
+  void erase(index_type cell);
+  // remplace l'element en <from> par <pos>, sur place
+  void move(index_type from, const Position& pos, index_type cell);
+  bool contains(index_type cell) const noexcept;
+  std::size_t size() const noexcept;
+  bool empty() const noexcept;
+  const std::vector<Position>& elements() const noexcept;
+private:
+  std::vector<Position> dense;
+  std::vector<index_type> cases; // case de chaque element de dense
+  std::vector<int> place; // dans dense, -1 si la case n'y est pas
+};
+
+#endif /* POSITIONSET_H_ */
@@ -0,0 +1,41 @@
+/*
+ * rapport.cpp
+ *
+ * Met en forme le journal d'une partie (diagnostic.bin) comme diagnostic.txt,
+ * par exemple apres un arret brutal de la racine.
+ *
+ * usage : rapport [journal] [etendre]
+ *
+ * Le rapport est ecrit sur la sortie standard ; avec etendre, les cartes
+ * journalisees en RLE (option rle de la racine) sont reecrites en clair.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "event_log.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  string chemin { "diagnostic.bin" };
+  bool etendre { };
+  for (int i = 1; i < argc; ++i) {
+    string arg { argv[i] };
+    if (arg == "etendre") {
+      etendre = true;
+    } else {
+      chemin = arg;
+    }
+  }
+  ifstream journal { chemin, ios::binary };
+  if (!journal) {
+    cerr << chemin << " : journal pas ouvrable" << endl;
+    return 1;
+  }
+  if (!write_report(journal, cout, etendre)) {
+    cerr << chemin << " : pas un journal" << endl;
+    return 1;
+  }
+}
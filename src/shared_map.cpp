@@ -0,0 +1,138 @@
+/*
+ * shared_map.cpp
+ */
+
+#include <algorithm>
+#include <new>
+#include <thread>
+
+#include "shared_map.h"
+
+using namespace std;
+
+const size_t shared_map::ring_capacity;
+
+MPI_Aint shared_map::segment_size(const Map* map) {
+  if (!map) {
+    return 0;
+  }
+  return sizeof(header) + ring_capacity * sizeof(entry)
+      + map->getSizeX() * map->getSizeY();
+}
+
+shared_map::shared_map(MPI_Comm comm, const Map* map)
+    : window_ { comm, segment_size(map) }, published_ { }, changes_ { },
+        copy_ { } {
+  if (map) {
+    auto h = new (window_.data()) header { };
+    h->size_x = static_cast<uint32_t>(map->getSizeX());
+    h->size_y = static_cast<uint32_t>(map->getSizeY());
+    for (size_t y = 0; y != map->getSizeY(); ++y) {
+      copy(map->getRow(y), map->getRow(y) + map->getSizeX(),
+          cells() + y * map->getSizeX());
+    }
+    h->version = h->covered = published_ = map->getVersion();
+    window_.sync();
+  }
+  MPI_Barrier(comm); // the segment is initialized before anyone reads it
+}
+
+shared_map::header* shared_map::head() const noexcept {
+  return reinterpret_cast<header*>(window_.data());
+}
+
+shared_map::entry* shared_map::ring() const noexcept {
+  return reinterpret_cast<entry*>(window_.data() + sizeof(header));
+}
+
+char* shared_map::cells() const noexcept {
+  return window_.data() + sizeof(header) + ring_capacity * sizeof(entry);
+}
+
+void shared_map::publish(const Map& map) {
+  if (map.getVersion() == published_) {
+    return;
+  }
+  auto h = head();
+  auto sequence = h->sequence.load(memory_order_relaxed);
+  h->sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  auto x = map.getSizeX();
+  changes_.clear();
+  if (map.ChangesSince(published_, changes_)) {
+    for (auto& c : changes_) {
+      auto i = static_cast<uint32_t>(c.pos.getY() * x + c.pos.getX());
+      cells()[i] = c.cell;
+      auto& e = ring()[h->written % ring_capacity];
+      if (h->written >= ring_capacity) {
+        h->covered = max(h->covered, e.version);
+      }
+      e = entry { c.version, i, c.cell };
+      ++h->written;
+    }
+  } else {
+    for (size_t y = 0; y != map.getSizeY(); ++y) {
+      copy(map.getRow(y), map.getRow(y) + x, cells() + y * x);
+    }
+    h->covered = map.getVersion();
+  }
+  h->version = published_ = map.getVersion();
+
+  window_.sync();
+  h->sequence.store(sequence + 2, memory_order_release);
+}
+
+void shared_map::read(unique_ptr<Map>& map) {
+  auto h = head();
+  size_t x = h->size_x, y = h->size_y;
+  bool full;
+  Map::version_type version;
+  for (;;) {
+    window_.sync();
+    auto sequence = h->sequence.load(memory_order_acquire);
+    if (sequence & 1) {
+      this_thread::yield(); // the root is writing
+      continue;
+    }
+    version = h->version;
+    full = !map || map->getVersion() < h->covered;
+    if (!full && map->getVersion() == version) {
+      return;
+    }
+    changes_.clear();
+    if (full) {
+      copy_.assign(cells(), cells() + x * y);
+    } else {
+      // versions only grow along the ring, walk back to the first one missed
+      auto written = h->written, first = written;
+      auto oldest = written - min<uint64_t>(written, ring_capacity);
+      while (first != oldest
+          && ring()[(first - 1) % ring_capacity].version > map->getVersion()) {
+        --first;
+      }
+      for (auto k = first; k != written; ++k) {
+        auto e = ring()[k % ring_capacity];
+        changes_.push_back(Map::Changement { e.version, Position {
+            static_cast<Position::coord_type>(e.index % x),
+            static_cast<Position::coord_type>(e.index / x) }, e.cell });
+      }
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (h->sequence.load(memory_order_relaxed) == sequence) {
+      break;
+    }
+  }
+  if (full) {
+    if (map) {
+      map->Assign(x, y, copy_.data());
+    } else {
+      map.reset(new Map { x, y, copy_.data() });
+    }
+  } else {
+    for (auto& c : changes_) {
+      map->Apply(c);
+    }
+  }
+  map->setVersion(version);
+}
@@ -0,0 +1,72 @@
+/*
+ * shared_map.h
+ *
+ * Map published by the root in shared memory for the Joueurs of the same node.
+ */
+
+#ifndef SHARED_MAP_H_
+#define SHARED_MAP_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "map.h"
+#include "mpi.h"
+
+/*
+ Map published by the root in an mpi_shared_window so Joueurs read it directly
+ and messages only carry positions and the map version.
+
+ Layout: header, ring of the last changed cells, then the cells row by row.
+ The header's sequence number is odd while the root writes (seqlock): a reader
+ copies what it needs then retries if the sequence changed meanwhile.
+ */
+class shared_map {
+public:
+  static const std::size_t ring_capacity = 4096;
+
+  /*
+   The root passes its map, the Joueurs nullptr.
+   #Collective-call over <comm> (root must be rank 0).
+   */
+  shared_map(MPI_Comm comm, const Map* map);
+  shared_map(const shared_map&) = delete;
+
+  /*
+   Root: publishes every change made to <map> since the last call.
+   */
+  void publish(const Map& map);
+
+  /*
+   Joueur: brings <map> (created if null) up to the published version, from
+   the ring when possible, from the whole grid otherwise.
+   */
+  void read(std::unique_ptr<Map>& map);
+
+private:
+  struct header {
+    std::atomic<std::uint64_t> sequence;
+    std::uint64_t version;
+    std::uint64_t covered; // every change after this version is in the ring
+    std::uint64_t written; // changes ever written to the ring
+    std::uint32_t size_x, size_y;
+  };
+  struct entry {
+    std::uint64_t version;
+    std::uint32_t index;
+    char cell;
+  };
+  static MPI_Aint segment_size(const Map*);
+  header* head() const noexcept;
+  entry* ring() const noexcept;
+  char* cells() const noexcept;
+
+  mpi_shared_window window_;
+  Map::version_type published_;
+  std::vector<Map::Changement> changes_;
+  std::vector<char> copy_;
+};
+
+#endif /* SHARED_MAP_H_ */
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "map.h"
+#include "spatialindex.h"
+
+using namespace std;
+
+const int SpatialIndex::cote = 8;
+
+SpatialIndex::SpatialIndex()
+    : nx { }, ny { }, nombre { }, seaux { } {
+}
+
+void SpatialIndex::reset(size_t x, size_t y) {
+  nx = static_cast<int>((x + cote - 1) / cote);
+  ny = static_cast<int>((y + cote - 1) / cote);
+  nombre = 0;
+  seaux.resize(static_cast<size_t>(nx) * ny);
+  for (auto& s : seaux) {
+    s.clear(); // les seaux gardent leur capacite d'une carte a l'autre
+  }
+}
+
+size_t SpatialIndex::seau(int bx, int by) const noexcept {
+  return static_cast<size_t>(by) * nx + bx;
+}
+
+void SpatialIndex::insert(const Position& pos) {
+  seaux[seau(pos.getX() / cote, pos.getY() / cote)].push_back(pos);
+  ++nombre;
+}
+
+void SpatialIndex::erase(const Position& pos) {
+  auto& s = seaux[seau(pos.getX() / cote, pos.getY() / cote)];
+  auto it = find(begin(s), end(s), pos);
+  if (it != end(s)) {
+    *it = s.back();
+    s.pop_back();
+    --nombre;
+  }
+}
+
+void SpatialIndex::move(const Position& from, const Position& to) {
+  auto& s = seaux[seau(from.getX() / cote, from.getY() / cote)];
+  if (&s == &seaux[seau(to.getX() / cote, to.getY() / cote)]) {
+    auto it = find(begin(s), end(s), from);
+    if (it != end(s)) {
+      *it = to;
+    }
+  } else {
+    erase(from);
+    insert(to);
+  }
+}
+
+size_t SpatialIndex::size() const noexcept {
+  return nombre;
+}
+
+template<class F>
+void SpatialIndex::anneau(int bx, int by, int r, F&& f) const {
+  auto visiter = [&](int x, int y) {
+    for (auto& p : seaux[seau(x, y)]) {
+      f(p);
+    }
+  };
+  auto x0 = max(bx - r, 0), x1 = min(bx + r, nx - 1);
+  for (auto y = max(by - r, 0); y <= min(by + r, ny - 1); ++y) {
+    if (y == by - r || y == by + r) {
+      for (auto x = x0; x <= x1; ++x) {
+        visiter(x, y);
+      }
+    } else { // entre les deux lignes du bord, seules les deux colonnes
+      if (bx - r >= 0) {
+        visiter(bx - r, y);
+      }
+      if (bx + r < nx) {
+        visiter(bx + r, y);
+      }
+    }
+  }
+}
+
+/*
+ Une position d'un seau de l'anneau r (r > 0) est a au moins (r - 1) * cote + 1
+ cases de la source : les anneaux suivants ne sont visites que si cette borne
+ ne depasse pas la meilleure distance trouvee.
+ */
+bool SpatialIndex::nearest(const Position& pos, Position& out) const {
+  if (!nombre) {
+    return false;
+  }
+  auto bx = min(max(pos.getX() / cote, 0), nx - 1);
+  auto by = min(max(pos.getY() / cote, 0), ny - 1);
+  auto meilleure = numeric_limits<int>::max();
+  for (int r = 0, fin = max(nx, ny); r != fin; ++r) {
+    if (r > 0 && (r - 1) * cote + 1 >= meilleure) {
+      break;
+    }
+    anneau(bx, by, r, [&](const Position& p) {
+      auto d = Map::ManhattanDistance(pos, p);
+      if (d < meilleure) {
+        meilleure = d;
+        out = p;
+      }
+    });
+  }
+  return true;
+}
+
+void SpatialIndex::nearest(const Position& pos, size_t k,
+    vector<Position>& out) const {
+  out.clear();
+  if (!nombre || !k) {
+    return;
+  }
+  auto bx = min(max(pos.getX() / cote, 0), nx - 1);
+  auto by = min(max(pos.getY() / cote, 0), ny - 1);
+  vector<pair<int, Position>> candidats;
+  auto plus_proche = [](const pair<int, Position>& a,
+      const pair<int, Position>& b) {return a.first < b.first;};
+  for (int r = 0, fin = max(nx, ny); r != fin; ++r) {
+    anneau(bx, by, r, [&](const Position& p) {
+      candidats.emplace_back(Map::ManhattanDistance(pos, p), p);
+    });
+    // le k-ieme candidat ne peut plus etre battu par l'anneau suivant
+    if (candidats.size() >= k) {
+      nth_element(begin(candidats), begin(candidats) + (k - 1),
+          end(candidats), plus_proche);
+      if (candidats[k - 1].first <= r * cote) {
+        break;
+      }
+    }
+  }
+  auto n = min(k, candidats.size());
+  partial_sort(begin(candidats), begin(candidats) + n, end(candidats),
+      plus_proche);
+  for (size_t i = 0; i != n; ++i) {
+    out.push_back(candidats[i].second);
+  }
+}
+
+void SpatialIndex::within(const Position& pos, int rayon,
+    vector<Position>& out) const {
+  if (!nombre) {
+    return;
+  }
+  auto bx = min(max(pos.getX() / cote, 0), nx - 1);
+  auto by = min(max(pos.getY() / cote, 0), ny - 1);
+  for (int r = 0, fin = max(nx, ny); r != fin; ++r) {
+    if (r > 0 && (r - 1) * cote + 1 >= rayon) {
+      break;
+    }
+    anneau(bx, by, r, [&](const Position& p) {
+      if (Map::ManhattanDistance(pos, p) < rayon) {
+        out.push_back(p);
+      }
+    });
+  }
+}
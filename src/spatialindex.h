@@ -0,0 +1,62 @@
+#ifndef SPATIALINDEX_H_
+#define SPATIALINDEX_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "position.h"
+
+/*
+ Index spatial d'un ensemble de positions : la carte est decoupee en seaux
+ de cote x cote cases, chacun tenant la liste des positions qu'il contient.
+
+ Une recherche ne visite que les anneaux de seaux autour de la source tant
+ qu'ils peuvent encore contenir une position plus proche (distance de
+ Manhattan) : son cout depend de la densite locale, pas de la population.
+ */
+class SpatialIndex {
+public:
+  static const int cote;
+
+  SpatialIndex();
+
+  /*
+   Vide l'index pour une carte de <x> par <y> cases.
+   */
+  void reset(std::size_t x, std::size_t y);
+  void insert(const Position&);
+  // sans effet si la position n'est pas dans l'index
+  void erase(const Position&);
+  void move(const Position& from, const Position& to);
+  std::size_t size() const noexcept;
+
+  /*
+   Position indexee la plus proche de <pos> dans <out>. Retourne faux si
+   l'index est vide.
+   */
+  bool nearest(const Position& pos, Position& out) const;
+
+  /*
+   Remplace <out> par les <k> positions les plus proches de <pos>, de la plus
+   proche a la plus lointaine (moins de <k> si l'index en contient moins).
+   */
+  void nearest(const Position& pos, std::size_t k,
+      std::vector<Position>& out) const;
+
+  /*
+   Ajoute a <out> les positions a une distance de <pos> strictement
+   inferieure a <rayon>.
+   */
+  void within(const Position& pos, int rayon, std::vector<Position>& out) const;
+private:
+  std::size_t seau(int bx, int by) const noexcept;
+  // seaux a exactement <r> seaux de (bx, by), bornes a la carte
+  template<class F>
+  void anneau(int bx, int by, int r, F&& f) const;
+
+  int nx, ny; // nombre de seaux par ligne et par colonne
+  std::size_t nombre;
+  std::vector<std::vector<Position>> seaux;
+};
+
+#endif /* SPATIALINDEX_H_ */
@@ -0,0 +1,96 @@
+/*
+ * thread_pool.cpp
+ */
+
+#include "thread_pool.h"
+
+using namespace std;
+
+thread_pool::thread_pool(size_t threads)
+    : threads_ { }, mutex_ { }, start_ { }, done_ { }, task_ { }, count_ { },
+        next_ { }, busy_ { }, round_ { }, stop_ { } {
+  for (size_t i = 1; i < threads; ++i) {
+    threads_.emplace_back(&thread_pool::run, this);
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    lock_guard<mutex> lock { mutex_ };
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+size_t thread_pool::size() const noexcept {
+  return threads_.size() + 1;
+}
+
+void thread_pool::parallel_for(size_t count,
+    const function<void(size_t)>& task, size_t grain) {
+  if (threads_.empty() || count < grain) {
+    for (size_t i = 0; i != count; ++i) {
+      task(i);
+    }
+    return;
+  }
+  launch(count, task);
+  work();
+  wait();
+}
+
+void thread_pool::launch(size_t count, const function<void(size_t)>& task) {
+  if (threads_.empty()) {
+    for (size_t i = 0; i != count; ++i) {
+      task(i);
+    }
+    return;
+  }
+  {
+    lock_guard<mutex> lock { mutex_ };
+    task_ = &task;
+    count_ = count;
+    next_ = 0;
+    busy_ = threads_.size();
+    ++round_;
+  }
+  start_.notify_all();
+}
+
+bool thread_pool::done() noexcept {
+  return busy_ == 0;
+}
+
+void thread_pool::wait() {
+  unique_lock<mutex> lock { mutex_ };
+  done_.wait(lock, [this] {return busy_ == 0;});
+  task_ = nullptr;
+}
+
+// indices are handed out one by one, the tasks are short and uneven
+void thread_pool::work() {
+  for (auto i = next_++; i < count_; i = next_++) {
+    (*task_)(i);
+  }
+}
+
+void thread_pool::run() {
+  size_t seen { };
+  unique_lock<mutex> lock { mutex_ };
+  for (;;) {
+    start_.wait(lock, [&] {return stop_ || round_ != seen;});
+    if (stop_) {
+      return;
+    }
+    seen = round_;
+    lock.unlock();
+    work();
+    lock.lock();
+    if (--busy_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ * thread_pool.h
+ *
+ * Fixed set of threads sharing the CPU-bound work of the root.
+ */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ Threads waiting for a parallel_for(), the calling thread takes part in it.
+ The tasks must not make MPI calls: MPI is only initialized for the thread
+ that called mpi_server's ctor (MPI_THREAD_FUNNELED).
+ */
+class thread_pool {
+public:
+  /*
+   <threads> counts the caller, 1 (or 0) means no extra thread at all.
+   */
+  explicit thread_pool(std::size_t threads);
+  thread_pool(const thread_pool&) = delete;
+  ~thread_pool();
+
+  std::size_t size() const noexcept;
+
+  /*
+   Calls <task>(i) for every i in [0, count) and returns once all are done.
+   Below <grain> calls, everything runs on the calling thread.
+   #Blocking-call
+   */
+  void parallel_for(std::size_t count,
+      const std::function<void(std::size_t)>& task, std::size_t grain = 16);
+
+  /*
+   Starts calling <task>(i) for every i in [0, count) on the extra threads only
+   and returns immediately, so the caller can consume what the tasks produce.
+   <task> must outlive the matching wait(). Without extra threads, everything
+   runs on the calling thread before launch() returns.
+   */
+  void launch(std::size_t count, const std::function<void(std::size_t)>& task);
+
+  /*
+   True once every task of the last launch() has returned.
+   */
+  bool done() noexcept;
+
+  /*
+   #Blocking-call until every task of the last launch() has returned.
+   */
+  void wait();
+
+private:
+  void run();
+  void work();
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_, done_;
+  const std::function<void(std::size_t)>* task_;
+  std::size_t count_;
+  std::atomic<std::size_t> next_;
+  std::atomic<std::size_t> busy_; // threads still inside the current round
+  std::size_t round_; // incremented by every parallel_for or launch
+  bool stop_;
+};
+
+#endif /* THREAD_POOL_H_ */
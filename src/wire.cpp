@@ -0,0 +1,131 @@
+/*
+ * wire.cpp
+ */
+
+#include "map.h"
+#include "wire.h"
+
+using namespace std;
+
+uint8_t wire_encode_cell(char c) noexcept {
+  switch (c) {
+  case VIDE:
+    return WC_VIDE;
+  case MUR:
+    return WC_MUR;
+  case FROMAGE:
+    return WC_FROMAGE;
+  case CHAT:
+    return WC_CHAT;
+  case RAT:
+    return WC_RAT;
+  default:
+    return WC_HORS;
+  }
+}
+
+char wire_decode_cell(uint8_t code) noexcept {
+  static const char cells[8] = { VIDE, MUR, FROMAGE, CHAT, RAT, HORS, HORS,
+      HORS };
+  return cells[code & 7];
+}
+
+wire_writer::wire_writer(string& out)
+    : out_ { out } {
+}
+
+void wire_writer::u8(uint8_t v) {
+  out_.push_back(static_cast<char>(v));
+}
+
+void wire_writer::u32(uint32_t v) {
+  for (int i = 0; i != 4; ++i) {
+    out_.push_back(static_cast<char>(v >> (8 * i)));
+  }
+}
+
+void wire_writer::u64(uint64_t v) {
+  for (int i = 0; i != 8; ++i) {
+    out_.push_back(static_cast<char>(v >> (8 * i)));
+  }
+}
+
+void wire_writer::i32(int32_t v) {
+  u32(static_cast<uint32_t>(v));
+}
+
+void wire_writer::position(const Position& p) {
+  i32(p.getX());
+  i32(p.getY());
+}
+
+void wire_writer::reserve(size_t more) {
+  out_.reserve(out_.size() + more);
+}
+
+wire_reader::wire_reader(const char* begin, const char* end)
+    : it_ { begin }, end_ { end }, good_ { true } {
+}
+
+wire_reader::wire_reader(const string& s)
+    : wire_reader(s.data(), s.data() + s.size()) {
+}
+
+const char* wire_reader::bytes(size_t n) noexcept {
+  if (!good_ || remaining() < n) {
+    good_ = false;
+    return nullptr;
+  }
+  auto p = it_;
+  it_ += n;
+  return p;
+}
+
+uint8_t wire_reader::u8() noexcept {
+  auto p = bytes(1);
+  return p ? static_cast<uint8_t>(*p) : 0;
+}
+
+uint32_t wire_reader::u32() noexcept {
+  auto p = bytes(4);
+  uint32_t v { };
+  for (int i = 0; p && i != 4; ++i) {
+    v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+uint64_t wire_reader::u64() noexcept {
+  auto p = bytes(8);
+  uint64_t v { };
+  for (int i = 0; p && i != 8; ++i) {
+    v |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+int32_t wire_reader::i32() noexcept {
+  return static_cast<int32_t>(u32());
+}
+
+Position wire_reader::position() noexcept {
+  auto x = i32();
+  auto y = i32();
+  return Position { x, y };
+}
+
+uint8_t wire_reader::peek() const noexcept {
+  return good_ && it_ != end_ ? static_cast<uint8_t>(*it_) : 0;
+}
+
+size_t wire_reader::remaining() const noexcept {
+  return static_cast<size_t>(end_ - it_);
+}
+
+bool wire_reader::good() const noexcept {
+  return good_;
+}
+
+void wire_reader::fail() noexcept {
+  good_ = false;
+}
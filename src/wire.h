@@ -0,0 +1,74 @@
+/*
+ * wire.h
+ *
+ * Binary encoding of the messages exchanged between the root and the Joueurs.
+ */
+
+#ifndef WIRE_H_
+#define WIRE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "position.h"
+
+/*
+ Version of the binary format, sent in every map header.
+ */
+const std::uint8_t wire_format = 1;
+
+/*
+ 3-bit codes of the cell kinds (SORTIE is a VIDE cell on the border).
+ */
+enum wire_cell : std::uint8_t {
+  WC_VIDE, WC_MUR, WC_FROMAGE, WC_CHAT, WC_RAT, WC_HORS
+};
+const unsigned wire_cell_bits = 3;
+
+std::uint8_t wire_encode_cell(char) noexcept;
+char wire_decode_cell(std::uint8_t) noexcept;
+
+/*
+ Appends fixed-width little-endian values to a std::string used as an mpi_message™ comment.
+ */
+class wire_writer {
+  std::string& out_;
+public:
+  explicit wire_writer(std::string& out);
+  void u8(std::uint8_t);
+  void u32(std::uint32_t);
+  void u64(std::uint64_t);
+  void i32(std::int32_t);
+  void position(const Position&);
+  void reserve(std::size_t more);
+};
+
+/*
+ Reads values written by a wire_writer straight from the received buffer, without copying it.
+ Reading past the end sets the reader in a failed state and yields zeros, like an istream.
+ */
+class wire_reader {
+  const char* it_;
+  const char* end_;
+  bool good_;
+public:
+  wire_reader(const char* begin, const char* end);
+  explicit wire_reader(const std::string&);
+  std::uint8_t u8() noexcept;
+  std::uint32_t u32() noexcept;
+  std::uint64_t u64() noexcept;
+  std::int32_t i32() noexcept;
+  Position position() noexcept;
+  /*
+   Returns a pointer to the next <n> bytes and skips them, nullptr if there are not enough.
+   */
+  const char* bytes(std::size_t n) noexcept;
+  std::uint8_t peek() const noexcept;
+  std::size_t remaining() const noexcept;
+  bool good() const noexcept;
+  // sets the failed state, for a value read that cannot be right
+  void fail() noexcept;
+};
+
+#endif /* WIRE_H_ */